@@ -0,0 +1,189 @@
+#include "BodySpool.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+using namespace std::filesystem;
+
+static std::atomic<size_t> BodyMemoryUsed = 0;
+
+#ifdef _WIN32
+SpooledBody::SpooledBody()
+{
+    wchar_t directory[MAX_PATH + 1];
+    wchar_t name[MAX_PATH + 1];
+    if (GetTempPathW(MAX_PATH + 1, directory) == 0 || GetTempFileNameW(directory, L"bdy", 0, name) == 0)
+    {
+        throw std::runtime_error("Couldn't name a temporary file for a request body");
+    }
+
+    /* Mostly kept in the cache, and deleted by the system once closed. */
+    m_Handle = CreateFileW(name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (m_Handle == INVALID_HANDLE_VALUE)
+    {
+        DeleteFileW(name);
+        throw std::runtime_error("Couldn't create a temporary file for a request body");
+    }
+}
+
+SpooledBody::~SpooledBody()
+{
+    CloseHandle(m_Handle);
+}
+
+void SpooledBody::Write(std::string_view data)
+{
+    while (!data.empty())
+    {
+        OVERLAPPED position = {};
+        position.Offset = (DWORD)m_Size;
+        position.OffsetHigh = (DWORD)((uint64_t)m_Size >> 32);
+
+        DWORD written = 0;
+        DWORD part = (DWORD)std::min<size_t>(data.size(), 1 << 30);
+        if (!WriteFile(m_Handle, data.data(), part, &written, &position))
+        {
+            throw std::runtime_error("Couldn't write a request body to a temporary file");
+        }
+
+        data.remove_prefix(written);
+        m_Size += written;
+    }
+}
+
+std::string SpooledBody::Read(size_t offset, size_t size) const
+{
+    std::string data(size, '\0');
+
+    size_t done = 0;
+    while (done < size)
+    {
+        OVERLAPPED position = {};
+        position.Offset = (DWORD)(offset + done);
+        position.OffsetHigh = (DWORD)((uint64_t)(offset + done) >> 32);
+
+        DWORD read = 0;
+        DWORD part = (DWORD)std::min<size_t>(size - done, 1 << 30);
+        if (!ReadFile(m_Handle, data.data() + done, part, &read, &position) || read == 0)
+        {
+            throw std::runtime_error("Couldn't read a request body from a temporary file");
+        }
+
+        done += read;
+    }
+
+    return data;
+}
+#else
+SpooledBody::SpooledBody()
+{
+    std::string directory = temp_directory_path().string();
+
+    /* Never linked into the directory at all where supported, otherwise
+       unlinked right after it is created. */
+#ifdef O_TMPFILE
+    m_Descriptor = open(directory.c_str(), O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+    if (m_Descriptor >= 0)
+    {
+        return;
+    }
+#endif
+
+    std::string name = directory + "/body-XXXXXX";
+    m_Descriptor = mkostemp(name.data(), O_CLOEXEC);
+    if (m_Descriptor < 0)
+    {
+        throw std::runtime_error("Couldn't create a temporary file for a request body in " + directory +
+                                 ": " + strerror(errno));
+    }
+
+    unlink(name.c_str());
+}
+
+SpooledBody::~SpooledBody()
+{
+    close(m_Descriptor);
+}
+
+void SpooledBody::Write(std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t written = pwrite(m_Descriptor, data.data(), data.size(), (off_t)m_Size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::runtime_error(std::string("Couldn't write a request body to a temporary file: ") +
+                                     strerror(errno));
+        }
+
+        data.remove_prefix((size_t)written);
+        m_Size += (size_t)written;
+    }
+}
+
+std::string SpooledBody::Read(size_t offset, size_t size) const
+{
+    std::string data(size, '\0');
+
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t result = pread(m_Descriptor, data.data() + done, size - done, (off_t)(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (result <= 0)
+        {
+            throw std::runtime_error(std::string("Couldn't read a request body from a temporary file: ") +
+                                     (result == 0 ? "unexpected end of file" : strerror(errno)));
+        }
+
+        done += (size_t)result;
+    }
+
+    return data;
+}
+#endif
+
+BodyMemory::~BodyMemory()
+{
+    BodyMemoryUsed -= m_Size;
+}
+
+bool BodyMemory::Reserve(size_t size)
+{
+    size_t used = BodyMemoryUsed.load();
+    do
+    {
+        if (size > InMemoryBodyBudget - used)
+        {
+            return false;
+        }
+    }
+    while (!BodyMemoryUsed.compare_exchange_weak(used, used + size));
+
+    m_Size += size;
+    return true;
+}
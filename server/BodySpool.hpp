@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/* Bodies up to that size are kept in memory, as long as the budget below
+   allows it. */
+constexpr size_t InMemoryBodyLimit = 1024 * 1024;
+
+/* Memory the bodies of all the requests being handled may take together. */
+constexpr size_t InMemoryBodyBudget = 64 * 1024 * 1024;
+
+/* Body of a request too large to be kept in memory, written to an unnamed
+   temporary file as it is received. The file disappears once closed, even
+   if the server is killed. */
+class SpooledBody
+{
+private:
+#ifdef _WIN32
+    void* m_Handle;
+#else
+    int m_Descriptor;
+#endif
+    size_t m_Size = 0;
+
+public:
+    /* Throws if no temporary file can be created. */
+    SpooledBody();
+
+    SpooledBody(const SpooledBody&) = delete;
+    SpooledBody& operator=(const SpooledBody&) = delete;
+
+    ~SpooledBody();
+
+    /* Appends to the body. */
+    void Write(std::string_view data);
+
+    /* Reads a part of the body, which has to be within it. */
+    std::string Read(size_t offset, size_t size) const;
+
+    size_t GetSize() const
+    {
+        return m_Size;
+    }
+};
+
+/* Memory taken by a body held by a request, counted against the budget
+   shared by all the connections until it is destroyed. */
+class BodyMemory
+{
+private:
+    size_t m_Size = 0;
+
+public:
+    BodyMemory() = default;
+
+    BodyMemory(const BodyMemory&) = delete;
+    BodyMemory& operator=(const BodyMemory&) = delete;
+
+    ~BodyMemory();
+
+    /* Returns false without reserving anything if the size doesn't fit in
+       what is left of the budget. */
+    bool Reserve(size_t size);
+};
@@ -0,0 +1,372 @@
+#include "Checksum.hpp"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define CRC32C_SSE42
+#endif
+
+/* Reflected Castagnoli polynomial. */
+constexpr uint32_t Crc32cPolynomial = 0x82F63B78;
+
+/* Eight tables, so that the fallback processes eight bytes per step. */
+static const std::array<std::array<uint32_t, 256>, 8> Crc32cTables = []()
+{
+    std::array<std::array<uint32_t, 256>, 8> tables = {};
+
+    for (uint32_t byte = 0; byte < 256; byte++)
+    {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (Crc32cPolynomial & (0 - (crc & 1)));
+        }
+        tables[0][byte] = crc;
+    }
+
+    for (uint32_t byte = 0; byte < 256; byte++)
+    {
+        for (size_t table = 1; table < 8; table++)
+        {
+            uint32_t previous = tables[table - 1][byte];
+            tables[table][byte] = (previous >> 8) ^ tables[0][previous & 0xFF];
+        }
+    }
+
+    return tables;
+}();
+
+static uint32_t Crc32cSoftware(uint32_t crc, const unsigned char* data, size_t size)
+{
+    const auto& t = Crc32cTables;
+
+    while (size >= 8)
+    {
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, data, 4);
+        std::memcpy(&high, data + 4, 4);
+        low ^= crc;
+
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+        data++;
+        size--;
+    }
+
+    return crc;
+}
+
+#ifdef CRC32C_SSE42
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t Crc32cHardware(uint32_t crc, const unsigned char* data, size_t size)
+{
+    uint64_t crc64 = crc;
+
+    while (size >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+
+        data += 8;
+        size -= 8;
+    }
+
+    crc = (uint32_t)crc64;
+    while (size > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+        data++;
+        size--;
+    }
+
+    return crc;
+}
+
+static bool HasSse42()
+{
+#ifdef _MSC_VER
+    int registers[4];
+    __cpuid(registers, 1);
+    return (registers[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+uint32_t Crc32c(std::string_view data, uint32_t crc)
+{
+    const unsigned char* bytes = (const unsigned char*)data.data();
+
+#ifdef CRC32C_SSE42
+    static const bool Hardware = HasSse42();
+    if (Hardware)
+    {
+        return ~Crc32cHardware(~crc, bytes, data.size());
+    }
+#endif
+
+    return ~Crc32cSoftware(~crc, bytes, data.size());
+}
+
+/* Appending zeros to a CRC is linear over GF(2), so it can be done for any
+   number of bytes by squaring the operator of appending one zero bit. */
+static uint32_t MultiplyMatrix(const uint32_t* matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+
+    while (vector != 0)
+    {
+        if (vector & 1)
+        {
+            sum ^= *matrix;
+        }
+
+        vector >>= 1;
+        matrix++;
+    }
+
+    return sum;
+}
+
+static void SquareMatrix(uint32_t* square, const uint32_t* matrix)
+{
+    for (size_t i = 0; i < 32; i++)
+    {
+        square[i] = MultiplyMatrix(matrix, matrix[i]);
+    }
+}
+
+uint32_t Crc32cCombine(uint32_t first, uint32_t second, size_t secondSize)
+{
+    if (secondSize == 0)
+    {
+        return first;
+    }
+
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    odd[0] = Crc32cPolynomial;
+    uint32_t row = 1;
+    for (size_t i = 1; i < 32; i++)
+    {
+        odd[i] = row;
+        row <<= 1;
+    }
+
+    /* Two and four zero bits. */
+    SquareMatrix(even, odd);
+    SquareMatrix(odd, even);
+
+    /* Every further square doubles the zeros, starting at a byte. */
+    do
+    {
+        SquareMatrix(even, odd);
+        if (secondSize & 1)
+        {
+            first = MultiplyMatrix(even, first);
+        }
+        secondSize >>= 1;
+
+        if (secondSize == 0)
+        {
+            break;
+        }
+
+        SquareMatrix(odd, even);
+        if (secondSize & 1)
+        {
+            first = MultiplyMatrix(odd, first);
+        }
+        secondSize >>= 1;
+    }
+    while (secondSize != 0);
+
+    return first ^ second;
+}
+
+std::string ToHex(std::string_view bytes)
+{
+    static const char Digits[] = "0123456789abcdef";
+
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+
+    for (unsigned char byte : bytes)
+    {
+        hex += Digits[byte >> 4];
+        hex += Digits[byte & 0xF];
+    }
+
+    return hex;
+}
+
+bool ParseDigest(std::string_view text, std::string& digest)
+{
+    size_t length;
+    if (text.starts_with("crc32c:"))
+    {
+        length = 7 + 8;
+    }
+    else if (text.starts_with("sha256:"))
+    {
+        length = 7 + 64;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (text.size() != length)
+    {
+        return false;
+    }
+
+    digest = text;
+    for (size_t i = 7; i < digest.size(); i++)
+    {
+        char& digit = digest[i];
+        if (digit >= 'A' && digit <= 'F')
+        {
+            digit = (char)(digit - 'A' + 'a');
+        }
+        else if (!(digit >= '0' && digit <= '9') && !(digit >= 'a' && digit <= 'f'))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Crc32cRanges::Add(size_t offset, std::string_view data)
+{
+    for (auto [begin, end] : GetGaps(offset, offset + data.size()))
+    {
+        std::string_view part = data.substr(begin - offset, end - begin);
+        Range range = { end, Crc32c(part) };
+
+        /* Merged with the neighbours it touches. */
+        auto next = m_Ranges.find(end);
+        if (next != m_Ranges.end())
+        {
+            range.m_Crc = Crc32cCombine(range.m_Crc, next->second.m_Crc, next->second.m_End - end);
+            range.m_End = next->second.m_End;
+            m_Ranges.erase(next);
+        }
+
+        auto previous = m_Ranges.lower_bound(begin);
+        if (previous != m_Ranges.begin() && std::prev(previous)->second.m_End == begin)
+        {
+            previous = std::prev(previous);
+            previous->second.m_Crc = Crc32cCombine(previous->second.m_Crc, range.m_Crc, range.m_End - begin);
+            previous->second.m_End = range.m_End;
+            continue;
+        }
+
+        m_Ranges.emplace(begin, range);
+    }
+}
+
+std::map<size_t, size_t> Crc32cRanges::GetGaps(size_t begin, size_t end) const
+{
+    std::map<size_t, size_t> gaps;
+
+    auto it = m_Ranges.upper_bound(begin);
+    if (it != m_Ranges.begin() && std::prev(it)->second.m_End > begin)
+    {
+        it = std::prev(it);
+    }
+
+    size_t position = begin;
+    for (; it != m_Ranges.end() && it->first < end; it++)
+    {
+        if (it->first > position)
+        {
+            gaps.emplace(position, it->first);
+        }
+
+        position = std::max(position, it->second.m_End);
+    }
+
+    if (position < end)
+    {
+        gaps.emplace(position, end);
+    }
+
+    return gaps;
+}
+
+bool Crc32cRanges::GetCrc(size_t size, uint32_t& crc) const
+{
+    if (size == 0)
+    {
+        crc = 0;
+        return true;
+    }
+
+    if (m_Ranges.size() != 1 || m_Ranges.begin()->first != 0 || m_Ranges.begin()->second.m_End != size)
+    {
+        return false;
+    }
+
+    crc = m_Ranges.begin()->second.m_Crc;
+    return true;
+}
+
+Sha256::Sha256() :
+    m_Context(EVP_MD_CTX_new())
+{
+    if (m_Context == nullptr || EVP_DigestInit_ex((EVP_MD_CTX*)m_Context, EVP_sha256(), nullptr) <= 0)
+    {
+        EVP_MD_CTX_free((EVP_MD_CTX*)m_Context);
+        throw std::runtime_error("Unable to initialize SHA-256");
+    }
+}
+
+Sha256::~Sha256()
+{
+    EVP_MD_CTX_free((EVP_MD_CTX*)m_Context);
+}
+
+void Sha256::Update(std::string_view data)
+{
+    if (EVP_DigestUpdate((EVP_MD_CTX*)m_Context, data.data(), data.size()) <= 0)
+    {
+        throw std::runtime_error("Unable to compute SHA-256");
+    }
+}
+
+std::string Sha256::Finish()
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+
+    if (EVP_DigestFinal_ex((EVP_MD_CTX*)m_Context, digest, &length) <= 0)
+    {
+        throw std::runtime_error("Unable to compute SHA-256");
+    }
+
+    return ToHex(std::string_view((const char*)digest, length));
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <cstdint>
+#include <string_view>
+
+/* CRC-32C (Castagnoli) of the data appended to the CRC of what precedes it,
+   zero for nothing. Uses the SSE4.2 instruction where the CPU has it. */
+uint32_t Crc32c(std::string_view data, uint32_t crc = 0);
+
+/* CRC of the concatenation of two blocks, from the CRCs of the blocks and
+   the size of the second one. */
+uint32_t Crc32cCombine(uint32_t first, uint32_t second, size_t secondSize);
+
+std::string ToHex(std::string_view bytes);
+
+/* Parses a digest declared by a client, "crc32c:" or "sha256:" followed by
+   the digest in hex. The result is in lowercase. */
+bool ParseDigest(std::string_view text, std::string& digest);
+
+/* CRCs of disjoint ranges of a file, adjacent ranges are merged into one.
+   The CRC of the whole file is known once a single range covers it. */
+class Crc32cRanges
+{
+private:
+    struct Range
+    {
+        size_t m_End;
+        uint32_t m_Crc;
+    };
+
+    std::map<size_t, Range> m_Ranges;
+
+public:
+    /* Parts of the data at offsets already in a range are skipped, they
+       hold the same bytes. */
+    void Add(size_t offset, std::string_view data);
+
+    /* The ranges within the interval that aren't known yet. */
+    std::map<size_t, size_t> GetGaps(size_t begin, size_t end) const;
+
+    /* False unless a single range covers the whole file. */
+    bool GetCrc(size_t size, uint32_t& crc) const;
+};
+
+/* Incremental SHA-256, with OpenSSL. */
+class Sha256
+{
+private:
+    void* m_Context;
+
+public:
+    Sha256();
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    ~Sha256();
+
+    void Update(std::string_view data);
+
+    /* The digest in lowercase hex, can only be called once. */
+    std::string Finish();
+};
@@ -1,5 +1,62 @@
 #include "Connection.hpp"
 
+#include <memory>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+/* Reused by every splice of a thread. A pipe that still holds data after a
+   failed write is thrown away. */
+struct SplicePipe
+{
+    static constexpr int PreferredSize = 1024 * 1024;
+
+    int m_Read = -1;
+    int m_Write = -1;
+    size_t m_Size = 0;
+
+    SplicePipe()
+    {
+        int descriptors[2];
+        if (pipe2(descriptors, O_CLOEXEC) != 0)
+        {
+            throw std::runtime_error(std::string("pipe2: ") + strerror(errno));
+        }
+
+        m_Read = descriptors[0];
+        m_Write = descriptors[1];
+
+        /* Larger pipes need fewer round trips, the size is capped by the
+           system though. */
+        fcntl(m_Write, F_SETPIPE_SZ, PreferredSize);
+        m_Size = (size_t)std::max(fcntl(m_Write, F_GETPIPE_SZ), 4096);
+    }
+
+    SplicePipe(const SplicePipe&) = delete;
+    SplicePipe& operator=(const SplicePipe&) = delete;
+
+    ~SplicePipe()
+    {
+        close(m_Read);
+        close(m_Write);
+    }
+};
+#endif
+
+void Connection::Establish()
+{
+    if (this->m_SslConnection != nullptr)
+    {
+        m_SslConnection->Accept(m_ClientSocket);
+    }
+}
+
 std::string Connection::ReceiveString(size_t len)
 {
     if (this->m_SslConnection == nullptr)
@@ -9,6 +66,70 @@ std::string Connection::ReceiveString(size_t len)
     return this->m_SslConnection->Read(len);
 }
 
+bool Connection::CanSplice() const
+{
+#ifdef __linux__
+    return m_SslConnection == nullptr;
+#else
+    return false;
+#endif
+}
+
+size_t Connection::SpliceToFile(int fileDescriptor, size_t offset, size_t size)
+{
+    size_t moved = 0;
+
+#ifdef __linux__
+    thread_local std::unique_ptr<SplicePipe> pipe;
+    if (pipe == nullptr)
+    {
+        pipe = std::make_unique<SplicePipe>();
+    }
+
+    loff_t fileOffset = (loff_t)offset;
+
+    while (moved < size)
+    {
+        ssize_t received = splice(m_ClientSocket.GetNativeDescriptor(), nullptr, pipe->m_Write, nullptr,
+                                  std::min(size - moved, pipe->m_Size), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (received <= 0)
+        {
+            break;
+        }
+
+        size_t pending = (size_t)received;
+        while (pending > 0)
+        {
+            ssize_t written = splice(pipe->m_Read, nullptr, fileDescriptor, &fileOffset, pending, SPLICE_F_MOVE);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (written <= 0)
+            {
+                int error = written < 0 ? errno : EIO;
+                pipe = nullptr;
+                throw std::runtime_error(std::string("splice: ") + strerror(error));
+            }
+
+            pending -= (size_t)written;
+        }
+
+        moved += (size_t)received;
+    }
+#else
+    throw std::runtime_error("Splicing is only supported on Linux");
+#endif
+
+    return moved;
+}
+
 bool Connection::Bad()
 {
     if (this->m_SslConnection != nullptr && this->m_SslConnection->Bad())
@@ -23,13 +144,73 @@ bool Connection::Eof()
     return this->m_ClientSocket.Eof();
 }
 
-void Connection::SendString(const std::string& str)
+void Connection::SendString(std::string_view str)
 {
     if (this->m_SslConnection == nullptr)
     {
-        m_ClientSocket.SendString(str);
+        m_ClientSocket.SendBytes((const InetSocketWrapper::byte*)str.data(), str.size());
         return;
     }
 
     m_SslConnection->Write(str);
-}
\ No newline at end of file
+}
+
+void Connection::SendFile(const std::filesystem::path& file, size_t size)
+{
+    size_t sent = 0;
+
+#ifdef __linux__
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        if (m_SslConnection != nullptr)
+        {
+            sent = m_SslConnection->SendFile(fd, 0, size);
+        }
+        else
+        {
+            off_t offset = 0;
+
+            while (sent < size)
+            {
+                auto result = sendfile(m_ClientSocket.GetNativeDescriptor(), fd, &offset, size - sent);
+                if (result <= 0)
+                {
+                    break;
+                }
+
+                sent += result;
+            }
+        }
+
+        close(fd);
+    }
+#endif
+
+    if (sent == size)
+    {
+        return;
+    }
+
+    /* Continue where the zero-copy path stopped, if it was used at all. */
+    constexpr size_t BufferSize = 16384;
+
+    std::ifstream stream(file, std::ios::binary);
+    stream.seekg(sent);
+
+    auto buffer = std::make_unique<char[]>(BufferSize);
+    while (sent < size && stream)
+    {
+        size_t currentSize = std::min(BufferSize, size - sent);
+        stream.read(buffer.get(), currentSize);
+
+        size_t readSize = (size_t)stream.gcount();
+        if (readSize == 0)
+        {
+            break;
+        }
+
+        SendString(std::string_view(buffer.get(), readSize));
+        sent += readSize;
+    }
+}
@@ -4,6 +4,8 @@
 
 #include "InetSocketWrapper.h"
 
+#include <filesystem>
+
 struct Connection
 {
     Connection(InetSocketWrapper::InetSocket&& socket,
@@ -20,14 +22,31 @@ struct Connection
 
     Connection(Connection&& connection) = default;
 
+    /* Completes the TLS handshake, if any. Done by the worker, not by the
+       accepting thread, so that slow clients can't stall accepting. */
+    void Establish();
+
     bool Bad();
     
     bool Eof();
 
-    void SendString(const std::string& str);
+    void SendString(std::string_view str);
+
+    /* Sends size bytes of the file, with sendfile or kernel TLS where
+       possible, and through a user-space buffer otherwise. */
+    void SendFile(const std::filesystem::path& file, size_t size);
     
     std::string ReceiveString(size_t len = 8192);
 
+    /* Only plain connections on Linux can move data with SpliceToFile. */
+    bool CanSplice() const;
+
+    /* Moves size bytes from the socket to the file at the offset through a
+       pipe, without copying them to user space. Returns the number of bytes
+       moved, fewer if the connection ended first. Throws if writing to the
+       file fails. */
+    size_t SpliceToFile(int fileDescriptor, size_t offset, size_t size);
+
     InetSocketWrapper::SocketAddress GetAddress() 
     {
         return this->m_ClientAddress;
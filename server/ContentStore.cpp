@@ -0,0 +1,328 @@
+#include "ContentStore.hpp"
+#include "Checksum.hpp"
+
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+using namespace std::filesystem;
+
+constexpr char IndexMagic[4] = { 'U', 'P', 'C', 'S' };
+constexpr uint32_t IndexVersion = 1;
+
+constexpr size_t DigestSize = 32;
+
+struct IndexHeader
+{
+    char m_Magic[4];
+    uint32_t m_Version;
+};
+
+struct IndexRecord
+{
+    unsigned char m_Digest[DigestSize];
+    uint64_t m_Size;
+};
+
+static_assert(sizeof(IndexRecord) == 40);
+
+/* Returns an empty string unless the text is a hex SHA-256 digest. */
+static std::string FromHex(std::string_view hex)
+{
+    if (hex.size() != DigestSize * 2)
+    {
+        return "";
+    }
+
+    auto value = [](char digit) -> int
+        {
+            if (digit >= '0' && digit <= '9')
+            {
+                return digit - '0';
+            }
+
+            if (digit >= 'a' && digit <= 'f')
+            {
+                return digit - 'a' + 10;
+            }
+
+            return -1;
+        };
+
+    std::string bytes(DigestSize, '\0');
+    for (size_t i = 0; i < DigestSize; i++)
+    {
+        int high = value(hex[2 * i]);
+        int low = value(hex[2 * i + 1]);
+        if (high < 0 || low < 0)
+        {
+            return "";
+        }
+
+        bytes[i] = (char)(high * 16 + low);
+    }
+
+    return bytes;
+}
+
+#ifdef __linux__
+/* Shares the blocks of the source on file systems that support it, so the
+   copy takes no space until either file changes. */
+static bool Reflink(const path& source, const path& target)
+{
+    int input = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input < 0)
+    {
+        return false;
+    }
+
+    int output = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (output < 0)
+    {
+        close(input);
+        return false;
+    }
+
+    bool cloned = ioctl(output, FICLONE, input) == 0;
+    close(output);
+    close(input);
+
+    if (!cloned)
+    {
+        std::error_code error;
+        remove(target, error);
+    }
+
+    return cloned;
+}
+#endif
+
+ContentStore& ContentStore::Get()
+{
+    static ContentStore store;
+    return store;
+}
+
+path ContentStore::GetObjectPath(const std::string& hex) const
+{
+    /* Spread over subdirectories, so none of them grows too large. */
+    return m_Directory / hex.substr(0, 2) / hex;
+}
+
+void ContentStore::AppendRecord(const std::string& digest, uint64_t size)
+{
+    IndexRecord record = {};
+    std::memcpy(record.m_Digest, digest.data(), DigestSize);
+    record.m_Size = size;
+
+    m_Index.write((const char*)&record, sizeof(record));
+    m_Index.flush();
+
+    if (!m_Index)
+    {
+        std::cerr << "[!] Couldn't append to the content index in " << m_Directory << "\n";
+        m_Index.clear();
+    }
+}
+
+void ContentStore::Load()
+{
+    create_directories(m_Directory);
+
+    path indexPath = m_Directory / "index";
+    std::vector<std::pair<std::string, uint64_t>> candidates;
+
+    std::ifstream input(indexPath, std::ios::binary);
+    IndexHeader header = {};
+    if (input.read((char*)&header, sizeof(header)) &&
+        std::memcmp(header.m_Magic, IndexMagic, sizeof(IndexMagic)) == 0 &&
+        header.m_Version == IndexVersion)
+    {
+        /* A record torn by a crash is ignored. */
+        IndexRecord record;
+        while (input.read((char*)&record, sizeof(record)))
+        {
+            candidates.emplace_back(std::string((const char*)record.m_Digest, DigestSize), record.m_Size);
+        }
+    }
+    else
+    {
+        if (exists(indexPath))
+        {
+            std::cerr << "[!] Rebuilding the incompatible content index " << indexPath << "\n";
+        }
+
+        for (auto& entry : recursive_directory_iterator(m_Directory))
+        {
+            std::string digest = FromHex(entry.path().filename().string());
+            if (entry.is_regular_file() && !digest.empty())
+            {
+                candidates.emplace_back(digest, entry.file_size());
+            }
+        }
+    }
+
+    input.close();
+
+    for (auto& [digest, size] : candidates)
+    {
+        path object = GetObjectPath(ToHex(digest));
+
+        std::error_code error;
+        auto links = hard_link_count(object, error);
+        if (error)
+        {
+            continue;
+        }
+
+        /* Only the store has it, the uploaded files were deleted. */
+        if (links == 1)
+        {
+            remove(object, error);
+            continue;
+        }
+
+        m_Objects[digest] = size;
+    }
+
+    /* Replaced at once, a crash leaves either index complete. */
+    path temporaryPath = m_Directory / "index.tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        IndexHeader newHeader = {};
+        std::memcpy(newHeader.m_Magic, IndexMagic, sizeof(IndexMagic));
+        newHeader.m_Version = IndexVersion;
+        output.write((const char*)&newHeader, sizeof(newHeader));
+
+        for (auto& [digest, size] : m_Objects)
+        {
+            IndexRecord record = {};
+            std::memcpy(record.m_Digest, digest.data(), DigestSize);
+            record.m_Size = size;
+            output.write((const char*)&record, sizeof(record));
+        }
+
+        if (!output.flush())
+        {
+            throw std::runtime_error("Unable to write the content index " + temporaryPath.string());
+        }
+    }
+
+    rename(temporaryPath, indexPath);
+
+    m_Index.open(indexPath, std::ios::binary | std::ios::app);
+    if (!m_Index)
+    {
+        throw std::runtime_error("Unable to open the content index " + indexPath.string());
+    }
+
+    std::cout << "[*] Indexed " << m_Objects.size() << " stored uploads in " << m_Directory << "\n";
+}
+
+void ContentStore::Enable(const path& uploadDirectory)
+{
+    std::lock_guard guard(m_Mutex);
+
+    m_Directory = uploadDirectory / ".objects";
+
+    try
+    {
+        Load();
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "[!] " << error.what() << ", uploads won't be deduplicated\n";
+        m_Objects.clear();
+    }
+}
+
+bool ContentStore::Link(const std::string& digest, size_t size, const path& target)
+{
+    if (!digest.starts_with("sha256:"))
+    {
+        return false;
+    }
+
+    std::string hex = digest.substr(7);
+    std::string key = FromHex(hex);
+    {
+        std::lock_guard guard(m_Mutex);
+
+        auto it = m_Objects.find(key);
+        if (!m_Index.is_open() || it == m_Objects.end() || it->second != size)
+        {
+            return false;
+        }
+    }
+
+    path object = GetObjectPath(hex);
+
+    std::error_code error;
+    create_hard_link(object, target, error);
+    if (!error)
+    {
+        return true;
+    }
+
+    /* Removed by hand, it is dropped from the index when it is loaded. */
+    if (!exists(object))
+    {
+        std::lock_guard guard(m_Mutex);
+        m_Objects.erase(key);
+        return false;
+    }
+
+    /* Too many links, or a store on another file system. */
+#ifdef __linux__
+    if (Reflink(object, target))
+    {
+        return true;
+    }
+#endif
+
+    std::cerr << "[!] Couldn't link " << target << " to the stored content: " << error.message() << "\n";
+    return false;
+}
+
+void ContentStore::Add(const std::string& digest, size_t size, const path& file)
+{
+    if (!digest.starts_with("sha256:"))
+    {
+        return;
+    }
+
+    std::string hex = digest.substr(7);
+    std::string key = FromHex(hex);
+
+    std::lock_guard guard(m_Mutex);
+
+    if (!m_Index.is_open() || key.empty() || m_Objects.count(key) > 0)
+    {
+        return;
+    }
+
+    path object = GetObjectPath(hex);
+
+    std::error_code error;
+    create_directories(object.parent_path(), error);
+    create_hard_link(file, object, error);
+
+    /* Stored before the index was lost. */
+    if (error && error != std::errc::file_exists)
+    {
+        std::cerr << "[!] Couldn't store " << file << ": " << error.message() << "\n";
+        return;
+    }
+
+    m_Objects.emplace(key, size);
+    AppendRecord(key, size);
+}
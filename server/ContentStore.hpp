@@ -0,0 +1,50 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <unordered_map>
+
+/* Uploaded files whose SHA-256 was verified, hard linked by their digest
+   into a directory of the upload directory. Uploading the same content
+   again, under any name, only takes a link to the stored file.
+
+   The stored digests are indexed in a file of fixed-size records, so that
+   lookups never touch the store itself. Records are only appended, the
+   index is rewritten when it is loaded. Stored files that aren't linked
+   from anywhere else anymore are removed at that point as well. */
+class ContentStore
+{
+private:
+    std::mutex m_Mutex;
+    std::filesystem::path m_Directory;
+    std::ofstream m_Index;
+
+    /* Raw digests mapped to the sizes of their content. */
+    std::unordered_map<std::string, uint64_t> m_Objects;
+
+    ContentStore() = default;
+
+    std::filesystem::path GetObjectPath(const std::string& hex) const;
+
+    void AppendRecord(const std::string& digest, uint64_t size);
+
+    /* Reads the index, removes what isn't used and rewrites it. */
+    void Load();
+
+public:
+    static ContentStore& Get();
+
+    /* Loads the index of the store in the upload directory, creating both
+       if needed. Until it is called, nothing is stored or linked. */
+    void Enable(const std::filesystem::path& uploadDirectory);
+
+    /* Links the stored content with the digest to the target, which
+       mustn't exist. Returns false if there is no such content, or it
+       couldn't be linked. Only SHA-256 digests are ever stored. */
+    bool Link(const std::string& digest, size_t size, const std::filesystem::path& target);
+
+    /* Stores a file whose content was checked against the digest. */
+    void Add(const std::string& digest, size_t size, const std::filesystem::path& file);
+};
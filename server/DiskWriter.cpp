@@ -0,0 +1,171 @@
+#include "DiskWriter.hpp"
+
+#include <thread>
+#include <iostream>
+#include <stdexcept>
+
+constexpr size_t DiskThreadCount = 4;
+
+/* Per transfer, a chunk larger than that is still taken once the queue is
+   empty. */
+constexpr size_t MaxQueuedBytes = 16 * 1024 * 1024;
+
+DiskWriter::DiskWriter()
+{
+    for (size_t i = 0; i < DiskThreadCount; i++)
+    {
+        std::thread(&DiskWriter::ThreadRoutine, this).detach();
+    }
+}
+
+/* The threads are never stopped, so the writer is never destroyed. */
+DiskWriter& DiskWriter::Get()
+{
+    static DiskWriter& writer = *new DiskWriter;
+    return writer;
+}
+
+void DiskWriter::Schedule(const std::shared_ptr<OngoingFileTransfer>& transfer)
+{
+    {
+        std::lock_guard guard(m_Mutex);
+        m_ReadyTransfers.push_back(transfer);
+    }
+
+    m_Ready.notify_one();
+}
+
+void DiskWriter::Push(const std::shared_ptr<OngoingFileTransfer>& transfer, PendingWrite write)
+{
+    {
+        std::unique_lock lock(transfer->m_QueueMutex);
+
+        transfer->m_QueueDrained.wait(lock,
+            [&]()
+            {
+                return transfer->m_Failed ||
+                       transfer->m_QueuedBytes == 0 ||
+                       transfer->m_QueuedBytes + write.m_Data.size() <= MaxQueuedBytes;
+            });
+
+        if (transfer->m_Failed)
+        {
+            throw std::runtime_error("The upload of " + transfer->m_Path.string() + " failed");
+        }
+
+        transfer->m_QueuedBytes += write.m_Data.size();
+        transfer->m_Queue.push_back(std::move(write));
+
+        if (transfer->m_Scheduled)
+        {
+            return;
+        }
+
+        transfer->m_Scheduled = true;
+    }
+
+    Schedule(transfer);
+}
+
+void DiskWriter::Enqueue(const std::shared_ptr<OngoingFileTransfer>& transfer, size_t offset, std::string data)
+{
+    Push(transfer, PendingWrite{ offset, std::move(data) });
+}
+
+void DiskWriter::EnqueueSpliced(const std::shared_ptr<OngoingFileTransfer>& transfer, size_t offset, size_t size)
+{
+    Push(transfer, PendingWrite{ offset, std::string(), size });
+}
+
+void DiskWriter::Drain(const std::shared_ptr<OngoingFileTransfer>& transfer)
+{
+    std::deque<PendingWrite> writes;
+    bool failed;
+    bool completed = false;
+    {
+        std::lock_guard guard(transfer->m_QueueMutex);
+        writes.swap(transfer->m_Queue);
+        failed = transfer->m_Failed;
+    }
+
+    for (auto& write : writes)
+    {
+        if (!failed)
+        {
+            try
+            {
+                if (write.m_SplicedSize > 0)
+                {
+                    completed = transfer->AddSpliced(write.m_Offset, write.m_SplicedSize) || completed;
+                }
+                else
+                {
+                    completed = transfer->Write(write.m_Offset, write.m_Data) || completed;
+                }
+            }
+            catch (const std::runtime_error& error)
+            {
+                std::cerr << "[!] " << error.what() << "\n";
+                transfer->SetFailed();
+                failed = true;
+            }
+        }
+
+        {
+            std::lock_guard guard(transfer->m_QueueMutex);
+
+            transfer->m_QueuedBytes -= write.m_Data.size();
+            transfer->m_Failed = transfer->m_Failed || failed;
+        }
+
+        transfer->m_QueueDrained.notify_all();
+    }
+
+    if (completed)
+    {
+        try
+        {
+            TransferRegistry::Complete(transfer->m_Id);
+        }
+        catch (const std::runtime_error& error)
+        {
+            std::cerr << "[!] " << error.what() << "\n";
+        }
+    }
+
+    /* Chunks queued in the meantime wait for the other transfers, so that
+       one busy transfer can't keep a thread to itself. */
+    {
+        std::lock_guard guard(transfer->m_QueueMutex);
+
+        if (transfer->m_Queue.empty())
+        {
+            transfer->m_Scheduled = false;
+            return;
+        }
+    }
+
+    Schedule(transfer);
+}
+
+void DiskWriter::ThreadRoutine()
+{
+    while (true)
+    {
+        std::shared_ptr<OngoingFileTransfer> transfer;
+        {
+            std::unique_lock lock(m_Mutex);
+
+            m_Ready.wait(lock,
+                [&]()
+                {
+                    return !m_ReadyTransfers.empty();
+                });
+
+            transfer = std::move(m_ReadyTransfers.front());
+            m_ReadyTransfers.pop_front();
+        }
+
+        Drain(transfer);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <string>
+#include <condition_variable>
+
+#include "FileTransfer.hpp"
+
+/* Writes the uploaded chunks to their files on a few threads of its own, so
+   that the threads serving connections never wait for the disk. Every
+   transfer has a bounded queue of chunks. A connection whose transfer has a
+   full queue waits before its chunk is taken, and doesn't read anything
+   else from its socket until then.
+
+   A transfer is drained by one thread at a time, different transfers are
+   written in parallel. The writer checksums the data as well, and finishes
+   the transfers it completes. */
+class DiskWriter
+{
+private:
+    std::mutex m_Mutex;
+    std::condition_variable m_Ready;
+    std::deque<std::shared_ptr<OngoingFileTransfer>> m_ReadyTransfers;
+
+    DiskWriter();
+
+    void Schedule(const std::shared_ptr<OngoingFileTransfer>& transfer);
+
+    void Push(const std::shared_ptr<OngoingFileTransfer>& transfer, PendingWrite write);
+
+    /* Writes the chunks queued so far. */
+    void Drain(const std::shared_ptr<OngoingFileTransfer>& transfer);
+
+    void ThreadRoutine();
+
+public:
+    static DiskWriter& Get();
+
+    /* Throws if writing an earlier chunk of the transfer failed. */
+    void Enqueue(const std::shared_ptr<OngoingFileTransfer>& transfer, size_t offset, std::string data);
+
+    /* Checksums and records data spliced into the file, which may complete
+       the transfer. */
+    void EnqueueSpliced(const std::shared_ptr<OngoingFileTransfer>& transfer, size_t offset, size_t size);
+};
@@ -1,8 +1,8 @@
 #pragma once
 
-#include "IndexPage.hpp"
+#include "Page.hpp"
 
-struct ErrorPage : public IndexPage
+struct ErrorPage : public Page
 {
     const int m_ErrorCode;
 
@@ -11,6 +11,11 @@ struct ErrorPage : public IndexPage
     {
     }
 
+    bool IsStatic() const
+    {
+        return true;
+    }
+
     std::string GetTitle() const override;
     int GetStatus() override;
 
@@ -4,8 +4,9 @@
 
 FileResponder::FileResponder(
     const std::filesystem::path& file,
-    const std::string& mimeType) :
-    m_File(file), m_MimeType(mimeType)
+    const std::string& mimeType,
+    bool isStatic) :
+    m_File(file), m_MimeType(mimeType), m_Static(isStatic)
 {
     if (mimeType == "")
     {
@@ -68,12 +69,25 @@ HttpResponse FileResponder::operator()(const Request& request)
         const Request& request;
         int sizeLeft;
         std::ifstream file;
+        std::filesystem::path path;
 
-        Promise(const Request& request, int sizeLeft, std::ifstream&& file) :
-            request(request), sizeLeft(sizeLeft), file(std::move(file)) 
+        Promise(const Request& request, int sizeLeft, std::ifstream&& file, const std::filesystem::path& path) :
+            request(request), sizeLeft(sizeLeft), file(std::move(file)), path(path)
         {
         }
 
+        bool CanTransmit() const override
+        {
+            return request.m_Method == "GET";
+        }
+
+        /* Uses sendfile, or SSL_sendfile with kernel TLS, when available. */
+        void Transmit(Connection& connection) override
+        {
+            connection.SendFile(path, sizeLeft);
+            sizeLeft = 0;
+        }
+
         std::string Fulfill() override
         {
             char buffer[BUFFER_SIZE] = { 0 };
@@ -95,7 +109,7 @@ HttpResponse FileResponder::operator()(const Request& request)
         }
     };
 
-    auto resp = HttpResponse(std::make_unique<Promise>(request, sizeLeft, std::move(file)), 200, m_MimeType);
+    auto resp = HttpResponse(std::make_unique<Promise>(request, sizeLeft, std::move(file), m_File), 200, m_MimeType);
     resp.m_Headers["Content-Length"] = std::to_string(sizeLeft);
     return resp;
 }
\ No newline at end of file
@@ -8,8 +8,18 @@ struct FileResponder
     std::filesystem::path m_File;
     std::string m_MimeType;
 
+    /* Files that never change while the server runs can be served from memory
+       after the first request. */
+    bool m_Static;
+
     FileResponder(const std::filesystem::path& file,
-                  const std::string& mimeType = "");
+                  const std::string& mimeType = "",
+                  bool isStatic = false);
 
     HttpResponse operator()(const Request& request);
+
+    bool IsStatic() const
+    {
+        return m_Static;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,681 @@
+#include "FileTransfer.hpp"
+#include "Connection.hpp"
+#include "ContentStore.hpp"
+#include "UploadQuota.hpp"
+#include "TransferJournal.hpp"
+
+#include <cstdio>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <shared_mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+using namespace std::filesystem;
+using namespace Timed;
+
+size_t RangeSet::Add(size_t begin, size_t end)
+{
+    if (begin >= end)
+    {
+        return 0;
+    }
+
+    size_t previousSize = m_Size;
+
+    /* The first range that could touch the new one. */
+    auto it = m_Ranges.upper_bound(begin);
+    if (it != m_Ranges.begin() && std::prev(it)->second >= begin)
+    {
+        it = std::prev(it);
+    }
+
+    while (it != m_Ranges.end() && it->first <= end)
+    {
+        begin = std::min(begin, it->first);
+        end = std::max(end, it->second);
+
+        m_Size -= it->second - it->first;
+        it = m_Ranges.erase(it);
+    }
+
+    m_Ranges.emplace_hint(it, begin, end);
+    m_Size += end - begin;
+
+    return m_Size - previousSize;
+}
+
+bool RangeSet::Contains(size_t begin, size_t end) const
+{
+    if (begin >= end)
+    {
+        return true;
+    }
+
+    auto it = m_Ranges.upper_bound(begin);
+    if (it == m_Ranges.begin())
+    {
+        return false;
+    }
+
+    return std::prev(it)->second >= end;
+}
+
+#ifdef _WIN32
+
+TransferFile::TransferFile(const path& path, size_t size, bool resume)
+{
+    m_Handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                           resume ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_Handle == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Couldn't open " + path.string());
+    }
+
+    if (resume)
+    {
+        return;
+    }
+
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+    if (!SetFilePointerEx(m_Handle, end, nullptr, FILE_BEGIN) || !SetEndOfFile(m_Handle))
+    {
+        CloseHandle(m_Handle);
+        throw std::runtime_error("Couldn't allocate " + path.string());
+    }
+}
+
+TransferFile::~TransferFile()
+{
+    CloseHandle(m_Handle);
+}
+
+void TransferFile::Write(size_t offset, std::string_view data)
+{
+    while (!data.empty())
+    {
+        OVERLAPPED position = {};
+        position.Offset = (DWORD)offset;
+        position.OffsetHigh = (DWORD)((uint64_t)offset >> 32);
+
+        DWORD written = 0;
+        DWORD size = (DWORD)std::min<size_t>(data.size(), 1 << 30);
+        if (!WriteFile(m_Handle, data.data(), size, &written, &position))
+        {
+            throw std::runtime_error("Couldn't write to an uploaded file");
+        }
+
+        offset += written;
+        data.remove_prefix(written);
+    }
+}
+
+std::string TransferFile::Read(size_t offset, size_t size)
+{
+    std::string data(size, '\0');
+
+    size_t done = 0;
+    while (done < size)
+    {
+        OVERLAPPED position = {};
+        position.Offset = (DWORD)(offset + done);
+        position.OffsetHigh = (DWORD)((uint64_t)(offset + done) >> 32);
+
+        DWORD read = 0;
+        DWORD part = (DWORD)std::min<size_t>(size - done, 1 << 30);
+        if (!ReadFile(m_Handle, data.data() + done, part, &read, &position) || read == 0)
+        {
+            throw std::runtime_error("Couldn't read an uploaded file");
+        }
+
+        done += read;
+    }
+
+    return data;
+}
+
+size_t TransferFile::Splice(Connection& connection, size_t offset, size_t size)
+{
+    throw std::runtime_error("Splicing is only supported on Linux");
+}
+
+void TransferFile::Sync()
+{
+    if (!FlushFileBuffers(m_Handle))
+    {
+        throw std::runtime_error("Couldn't sync an uploaded file");
+    }
+}
+
+#else
+
+TransferFile::TransferFile(const path& path, size_t size, bool resume)
+{
+    int flags = resume ? O_RDWR | O_CLOEXEC : O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    m_Descriptor = open(path.c_str(), flags, 0644);
+    if (m_Descriptor < 0)
+    {
+        throw std::runtime_error("Couldn't open " + path.string() + ": " + strerror(errno));
+    }
+
+    if (resume || size == 0)
+    {
+        return;
+    }
+
+    /* Allocating the blocks up front keeps chunks written out of order from
+       fragmenting the file, and fails early if the disk is full. Not every
+       file system supports it, the size is set either way. */
+    int result = -1;
+#ifdef __linux__
+    result = fallocate(m_Descriptor, 0, 0, (off_t)size);
+    if (result != 0 && errno == ENOSPC)
+    {
+        close(m_Descriptor);
+        throw std::runtime_error("No space left for " + path.string());
+    }
+#endif
+
+    if (result != 0 && ftruncate(m_Descriptor, (off_t)size) != 0)
+    {
+        int error = errno;
+        close(m_Descriptor);
+        throw std::runtime_error("Couldn't allocate " + path.string() + ": " + strerror(error));
+    }
+}
+
+TransferFile::~TransferFile()
+{
+    close(m_Descriptor);
+}
+
+void TransferFile::Write(size_t offset, std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t written = pwrite(m_Descriptor, data.data(), data.size(), (off_t)offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::runtime_error(std::string("Couldn't write to an uploaded file: ") + strerror(errno));
+        }
+
+        offset += (size_t)written;
+        data.remove_prefix((size_t)written);
+    }
+}
+
+std::string TransferFile::Read(size_t offset, size_t size)
+{
+    std::string data(size, '\0');
+
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t result = pread(m_Descriptor, data.data() + done, size - done, (off_t)(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (result <= 0)
+        {
+            throw std::runtime_error(std::string("Couldn't read an uploaded file: ") +
+                                     (result == 0 ? "unexpected end of file" : strerror(errno)));
+        }
+
+        done += (size_t)result;
+    }
+
+    return data;
+}
+
+size_t TransferFile::Splice(Connection& connection, size_t offset, size_t size)
+{
+    return connection.SpliceToFile(m_Descriptor, offset, size);
+}
+
+void TransferFile::Sync()
+{
+#ifdef __linux__
+    int result = fdatasync(m_Descriptor);
+#else
+    int result = fsync(m_Descriptor);
+#endif
+
+    if (result != 0)
+    {
+        throw std::runtime_error(std::string("Couldn't sync an uploaded file: ") + strerror(errno));
+    }
+}
+
+#endif
+
+namespace TransferRegistry
+{
+    /* Set once at startup, if transfers are persisted. */
+    static TransferJournal* Journal = nullptr;
+}
+
+/* How long the result of a finished transfer can still be queried. */
+constexpr auto FinishedTransferRetention = std::chrono::minutes(10);
+
+/* Data is read back for checksumming in blocks of that size. */
+constexpr size_t ReadBackBlockSize = 1024 * 1024;
+
+static TimedEvent::ExpirationDate ToExpirationDate(std::chrono::system_clock::time_point expiration)
+{
+    auto left = std::max(expiration - std::chrono::system_clock::now(), std::chrono::system_clock::duration::zero());
+    return TimedEvent::Clock::now() + std::chrono::duration_cast<TimedEvent::Clock::duration>(left);
+}
+
+OngoingFileTransfer::OngoingFileTransfer(TransferRegistry::TransferId id,
+                                         const path& path,
+                                         size_t sizeTotal,
+                                         std::chrono::system_clock::time_point expiration,
+                                         const std::string& expectedDigest,
+                                         bool resume) :
+    m_Path(path),
+    m_Id(id),
+    m_SizeTotal(sizeTotal),
+    m_Expiration(expiration),
+    m_ExpectedDigest(expectedDigest),
+    m_File(path, sizeTotal, resume),
+    m_Event(std::make_unique<TimedEvent>(
+        ToExpirationDate(expiration),
+        [id]()
+        {
+            TransferRegistry::Expire(id);
+        }))
+{
+    if (m_ExpectedDigest.starts_with("sha256:"))
+    {
+        m_Sha256 = std::make_unique<Sha256>();
+    }
+}
+
+void OngoingFileTransfer::AddChecksummed(size_t offset, std::string_view data)
+{
+    m_Crc.Add(offset, data);
+
+    if (m_Sha256 != nullptr && offset <= m_Sha256Offset && m_Sha256Offset < offset + data.size())
+    {
+        m_Sha256->Update(data.substr(m_Sha256Offset - offset));
+        m_Sha256Offset = offset + data.size();
+    }
+}
+
+bool OngoingFileTransfer::Write(size_t offset, std::string_view data)
+{
+    offset = std::min(offset, m_SizeTotal);
+    data = data.substr(0, m_SizeTotal - offset);
+
+    m_File.Write(offset, data);
+    AddChecksummed(offset, data);
+
+    return AddReceived(offset, data.size());
+}
+
+bool OngoingFileTransfer::AddSpliced(size_t offset, size_t size)
+{
+    for (size_t done = 0; done < size; done += ReadBackBlockSize)
+    {
+        size_t part = std::min(size - done, ReadBackBlockSize);
+        AddChecksummed(offset + done, m_File.Read(offset + done, part));
+    }
+
+    return AddReceived(offset, size);
+}
+
+bool OngoingFileTransfer::AddReceived(size_t offset, size_t size)
+{
+    {
+        std::lock_guard guard(m_Mutex);
+
+        m_Received.Add(offset, offset + size);
+        if (!m_Completed && m_Received.GetSize() == m_SizeTotal)
+        {
+            m_Completed = true;
+            return true;
+        }
+    }
+
+    if (TransferRegistry::Journal != nullptr)
+    {
+        TransferRegistry::Journal->MarkDirty(*this);
+    }
+
+    return false;
+}
+
+size_t OngoingFileTransfer::ReserveAppend(size_t size)
+{
+    std::lock_guard guard(m_Mutex);
+
+    size_t offset = m_AppendOffset;
+    m_AppendOffset = std::min(m_AppendOffset + size, m_SizeTotal);
+
+    return offset;
+}
+
+void OngoingFileTransfer::Finalize()
+{
+    /* Data received before a restart, or spliced data that overlapped a
+       range already written. */
+    for (auto [begin, end] : m_Crc.GetGaps(0, m_SizeTotal))
+    {
+        for (size_t offset = begin; offset < end; offset += ReadBackBlockSize)
+        {
+            m_Crc.Add(offset, m_File.Read(offset, std::min(end - offset, ReadBackBlockSize)));
+        }
+    }
+
+    uint32_t crc;
+    if (!m_Crc.GetCrc(m_SizeTotal, crc))
+    {
+        throw std::runtime_error("Couldn't checksum " + m_Path.string());
+    }
+
+    char crcHex[9];
+    snprintf(crcHex, sizeof(crcHex), "%08x", crc);
+
+    std::string checksum = std::string("crc32c:") + crcHex;
+    bool matches = m_ExpectedDigest.empty() || m_ExpectedDigest == checksum;
+
+    if (m_Sha256 != nullptr)
+    {
+        for (size_t offset = m_Sha256Offset; offset < m_SizeTotal; offset += ReadBackBlockSize)
+        {
+            m_Sha256->Update(m_File.Read(offset, std::min(m_SizeTotal - offset, ReadBackBlockSize)));
+        }
+        m_Sha256Offset = m_SizeTotal;
+
+        std::string sha256 = "sha256:" + m_Sha256->Finish();
+        m_Sha256.reset();
+
+        matches = m_ExpectedDigest == sha256;
+        checksum += ", " + sha256;
+    }
+
+    TransferStatus status = TransferStatus::Complete;
+    if (matches)
+    {
+        m_File.Sync();
+
+        /* The content was checked against the digest, so it can be found
+           by it. */
+        if (m_ExpectedDigest.starts_with("sha256:"))
+        {
+            ContentStore::Get().Add(m_ExpectedDigest, m_SizeTotal, m_Path);
+        }
+    }
+    else
+    {
+        std::cerr << "[!] " << m_Path << " doesn't match its digest " << m_ExpectedDigest << ", deleting it\n";
+
+        std::error_code error;
+        remove(m_Path, error);
+        UploadQuota::Get().RemoveFile(m_Path, m_SizeTotal);
+        status = TransferStatus::Mismatch;
+    }
+
+    std::lock_guard guard(m_Mutex);
+
+    m_Status = status;
+    m_Checksum = checksum;
+    m_Durable = m_Received;
+}
+
+RangeSet OngoingFileTransfer::GetResumableRanges()
+{
+    std::lock_guard guard(m_Mutex);
+
+    if (TransferRegistry::Journal == nullptr)
+    {
+        return m_Received;
+    }
+
+    return m_Durable;
+}
+
+TransferStatus OngoingFileTransfer::GetStatus(std::string* checksum)
+{
+    std::lock_guard guard(m_Mutex);
+
+    if (checksum != nullptr)
+    {
+        *checksum = m_Checksum;
+    }
+
+    return m_Status;
+}
+
+void OngoingFileTransfer::SetFailed()
+{
+    std::lock_guard guard(m_Mutex);
+    m_Status = TransferStatus::Failed;
+}
+
+namespace TransferRegistry
+{
+    static std::shared_mutex Mutex;
+    static std::unordered_map<TransferId, std::shared_ptr<OngoingFileTransfer>> Transfers;
+
+    TransferId AddTransfer(const path& path, size_t size, const std::string& expectedDigest)
+    {
+        std::unique_lock lock(Mutex);
+
+        TransferId id;
+        do
+        {
+            id = rand();
+        }
+        while (id == 0 || Transfers.count(id) > 0);
+
+        /* The ID is reserved while the file is created outside of the
+           lock, allocating it may take a while. */
+        Transfers.emplace(id, nullptr);
+        lock.unlock();
+
+        std::shared_ptr<OngoingFileTransfer> transfer;
+        try
+        {
+            transfer = std::make_shared<OngoingFileTransfer>(
+                id, path, size, std::chrono::system_clock::now() + TransferLifetime, expectedDigest);
+
+            if (Journal != nullptr)
+            {
+                Journal->Add(*transfer);
+            }
+        }
+        catch (...)
+        {
+            lock.lock();
+            Transfers.erase(id);
+            throw;
+        }
+
+        lock.lock();
+        Transfers[id] = transfer;
+        lock.unlock();
+
+        /* Only once it is registered, the event may expire right away. */
+        transfer->m_Event->AddEvent();
+        return id;
+    }
+
+    std::shared_ptr<OngoingFileTransfer> Find(TransferId id)
+    {
+        std::shared_lock lock(Mutex);
+
+        auto it = Transfers.find(id);
+        if (it == Transfers.end())
+        {
+            return nullptr;
+        }
+
+        return it->second;
+    }
+
+    void Remove(TransferId id)
+    {
+        std::shared_ptr<OngoingFileTransfer> transfer;
+
+        std::unique_lock lock(Mutex);
+
+        auto it = Transfers.find(id);
+        if (it != Transfers.end())
+        {
+            transfer = std::move(it->second);
+            Transfers.erase(it);
+        }
+
+        lock.unlock();
+
+        if (transfer != nullptr && Journal != nullptr)
+        {
+            Journal->Remove(*transfer);
+        }
+    }
+
+    void Expire(TransferId id)
+    {
+        auto transfer = Find(id);
+        Remove(id);
+
+        if (transfer == nullptr)
+        {
+            return;
+        }
+
+        /* Nothing can resume it anymore. */
+        auto status = transfer->GetStatus();
+        if (status == TransferStatus::Pending || status == TransferStatus::Failed)
+        {
+            std::cout << "[*] Deleting the expired upload of " << transfer->m_Path << "\n";
+
+            std::error_code error;
+            remove(transfer->m_Path, error);
+            UploadQuota::Get().RemoveFile(transfer->m_Path, transfer->m_SizeTotal);
+        }
+    }
+
+    void Complete(TransferId id)
+    {
+        auto transfer = Find(id);
+        if (transfer == nullptr)
+        {
+            return;
+        }
+
+        /* The journal forgets the transfer, what it leaves behind has to be
+           the whole file. */
+        try
+        {
+            transfer->Finalize();
+        }
+        catch (const std::runtime_error& error)
+        {
+            std::cerr << "[!] " << error.what() << "\n";
+            transfer->SetFailed();
+        }
+
+        if (Journal != nullptr)
+        {
+            Journal->Remove(*transfer);
+        }
+
+        /* Unless it already expired. */
+        if (transfer->m_Event->Cancel())
+        {
+            transfer->m_Event->m_ExpirationDate = TimedEvent::Clock::now() + FinishedTransferRetention;
+            transfer->m_Event->AddEvent();
+        }
+    }
+
+    void EnablePersistence(const path& uploadDirectory)
+    {
+        auto journalPath = TransferJournal::GetPath(uploadDirectory);
+
+        try
+        {
+            Journal = new TransferJournal(journalPath);
+        }
+        catch (const std::runtime_error& error)
+        {
+            std::cerr << "[!] " << error.what() << ", uploads won't be resumable\n";
+            return;
+        }
+
+        size_t restored = 0;
+        size_t completed = 0;
+        for (auto& record : Journal->Restore())
+        {
+            std::shared_ptr<OngoingFileTransfer> transfer;
+            try
+            {
+                transfer = std::make_shared<OngoingFileTransfer>(
+                    record.m_Id, record.m_Path, record.m_Size, record.m_Expiration, record.m_ExpectedDigest, true);
+            }
+            catch (const std::runtime_error& error)
+            {
+                std::cerr << "[!] Can't resume the upload of " << record.m_Path << ": " << error.what() << "\n";
+                Journal->Release(record.m_Slot);
+                continue;
+            }
+
+            auto& ranges = record.m_Received.GetRanges();
+            if (!ranges.empty() && ranges.begin()->first == 0)
+            {
+                transfer->m_AppendOffset = ranges.begin()->second;
+            }
+
+            transfer->m_Received = record.m_Received;
+            transfer->m_Durable = record.m_Received;
+            transfer->m_JournalSlot = record.m_Slot;
+
+            /* Received completely, but the server stopped before it was
+               finalized. */
+            bool complete = record.m_Received.GetSize() == record.m_Size;
+            transfer->m_Completed = complete;
+
+            {
+                std::unique_lock lock(Mutex);
+                Transfers.emplace(record.m_Id, transfer);
+            }
+
+            transfer->m_Event->AddEvent();
+
+            if (complete)
+            {
+                Complete(record.m_Id);
+                completed++;
+            }
+            else
+            {
+                restored++;
+            }
+        }
+
+        std::cout << "[*] Restored " << restored << " uploads and finished " << completed << " from "
+                  << journalPath << "\n";
+    }
+}
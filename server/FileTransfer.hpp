@@ -0,0 +1,226 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <condition_variable>
+#include <string_view>
+#include <filesystem>
+
+#include "Checksum.hpp"
+#include "TimedEvent.hpp"
+
+struct Connection;
+
+/* Set of disjoint half-open byte ranges, adjacent and overlapping ranges
+   are merged when added. */
+class RangeSet
+{
+private:
+    /* Beginning of each range mapped to its end. */
+    std::map<size_t, size_t> m_Ranges;
+    size_t m_Size = 0;
+
+public:
+    /* Returns the number of bytes that weren't in the set yet. */
+    size_t Add(size_t begin, size_t end);
+
+    bool Contains(size_t begin, size_t end) const;
+
+    /* Number of bytes in the set. */
+    size_t GetSize() const
+    {
+        return m_Size;
+    }
+
+    const std::map<size_t, size_t>& GetRanges() const
+    {
+        return m_Ranges;
+    }
+};
+
+/* File written at explicit offsets, so that chunks can be written
+   concurrently and in any order. */
+class TransferFile
+{
+private:
+#ifdef _WIN32
+    void* m_Handle;
+#else
+    int m_Descriptor;
+#endif
+
+public:
+    /* Creates or truncates the file and reserves the space for all of its
+       content. When resuming, the file has to exist and is left as it is. */
+    TransferFile(const std::filesystem::path& path, size_t size, bool resume = false);
+
+    TransferFile(const TransferFile&) = delete;
+    TransferFile& operator=(const TransferFile&) = delete;
+
+    ~TransferFile();
+
+    void Write(size_t offset, std::string_view data);
+
+    /* Reads size bytes at the offset, the file has to be that large. */
+    std::string Read(size_t offset, size_t size);
+
+    /* Moves size bytes from the connection to the file at the offset, see
+       Connection::SpliceToFile. */
+    size_t Splice(Connection& connection, size_t offset, size_t size);
+
+    /* Returns once everything written is on the disk. */
+    void Sync();
+};
+
+namespace TransferRegistry
+{
+    using TransferId = int;
+}
+
+constexpr auto TransferLifetime = std::chrono::hours(1);
+
+constexpr size_t NoJournalSlot = (size_t)-1;
+
+/* Data spliced into the file is only checksummed and recorded, it is read
+   back while it is still cached. */
+struct PendingWrite
+{
+    size_t m_Offset;
+    std::string m_Data;
+    size_t m_SplicedSize = 0;
+};
+
+enum class TransferStatus
+{
+    Pending,
+    Complete,
+    Mismatch,
+    Failed
+};
+
+struct OngoingFileTransfer : std::enable_shared_from_this<OngoingFileTransfer>
+{
+    // TODO: std::weak_ptr<Session*> m_Session;
+    const std::filesystem::path m_Path;
+    const TransferRegistry::TransferId m_Id;
+    const size_t m_SizeTotal;
+
+    /* Wall clock time, so that it stays meaningful across restarts. */
+    const std::chrono::system_clock::time_point m_Expiration;
+
+    /* "crc32c:" or "sha256:" followed by the lowercase hex digest the
+       client declared, empty if it didn't. */
+    const std::string m_ExpectedDigest;
+
+    TransferFile m_File;
+
+    /* Guards the received ranges and the result, the file itself is written
+       without it. */
+    std::mutex m_Mutex;
+    RangeSet m_Received;
+    size_t m_AppendOffset = 0;
+    bool m_Completed = false;
+    TransferStatus m_Status = TransferStatus::Pending;
+    std::string m_Checksum;
+
+    /* Checksums of the data written so far. Only used by the disk writer,
+       which drains a transfer on one thread at a time. SHA-256 can't be
+       combined, it is only computed if the client asked for it and takes
+       the data in order, what arrives out of order is read back when the
+       transfer completes. */
+    Crc32cRanges m_Crc;
+    std::unique_ptr<Sha256> m_Sha256;
+    size_t m_Sha256Offset = 0;
+
+    /* The received ranges that were synced to the disk and recorded in the
+       journal, what a client resumes from. */
+    RangeSet m_Durable;
+
+    /* Set when ranges were received since the journal last synced the
+       transfer. */
+    std::atomic<bool> m_Dirty = false;
+
+    /* Guarded by the lock of the journal. */
+    size_t m_JournalSlot = NoJournalSlot;
+
+    /* Chunks received but not yet written, the disk writer drains them.
+       Bytes being written still count as queued. */
+    std::mutex m_QueueMutex;
+    std::condition_variable m_QueueDrained;
+    std::deque<PendingWrite> m_Queue;
+    size_t m_QueuedBytes = 0;
+    bool m_Scheduled = false;
+    bool m_Failed = false;
+
+    /* Removes the transfer from the registry, the file is closed once the
+       requests still writing to it are done. */
+    std::unique_ptr<Timed::TimedEvent> m_Event;
+
+    OngoingFileTransfer(TransferRegistry::TransferId id,
+                        const std::filesystem::path& path,
+                        size_t sizeTotal,
+                        std::chrono::system_clock::time_point expiration,
+                        const std::string& expectedDigest = "",
+                        bool resume = false);
+
+    /* Adds the data to the checksums. */
+    void AddChecksummed(size_t offset, std::string_view data);
+
+    /* Data past the end of the file is dropped. Returns true for the write
+       that completed the transfer. */
+    bool Write(size_t offset, std::string_view data);
+
+    /* Checksums and records data spliced into the file. Returns true if it
+       completed the transfer. */
+    bool AddSpliced(size_t offset, size_t size);
+
+    /* Returns true if the data completed the transfer. */
+    bool AddReceived(size_t offset, size_t size);
+
+    /* Checksums what wasn't checksummed yet and compares the result with
+       the expected digest. A file that doesn't match is deleted, the
+       others are synced. */
+    void Finalize();
+
+    /* Offset of a chunk sent without one, chunks like that are placed one
+       after another in the order they arrive. */
+    size_t ReserveAppend(size_t size);
+
+    /* The ranges a client can rely on being kept if the server restarts. */
+    RangeSet GetResumableRanges();
+
+    /* The checksum is only known once the transfer is finished. */
+    TransferStatus GetStatus(std::string* checksum = nullptr);
+
+    void SetFailed();
+};
+
+/* Transfers are shared between the registry and the requests writing to
+   them. The registry lock is only held to look a transfer up. */
+namespace TransferRegistry
+{
+    TransferId AddTransfer(const std::filesystem::path& path, size_t size, const std::string& expectedDigest = "");
+
+    std::shared_ptr<OngoingFileTransfer> Find(TransferId id);
+
+    /* The transfer is destroyed once the last request using it is done. */
+    void Remove(TransferId id);
+
+    /* Removes the transfer once it ran out of time, deleting the file and
+       releasing its space unless it was completed. */
+    void Expire(TransferId id);
+
+    /* Finalizes the transfer and forgets it in the journal. It stays in the
+       registry for a while, so that clients can query the result. */
+    void Complete(TransferId id);
+
+    /* Restores the transfers recorded in a journal next to the upload
+       directory and keeps recording them there. Has to be called before any
+       transfer is added. */
+    void EnablePersistence(const std::filesystem::path& uploadDirectory);
+}
@@ -4,8 +4,15 @@
 #include <memory>
 #include <list>
 #include <map>
-#include <regex>
 #include <set>
+#include <new>
+#include <cstddef>
+#include <algorithm>
+#include <string_view>
+#include <functional>
+#include <vector>
+#include <concepts>
+#include <type_traits>
 
 template<typename T, typename TagType>
 concept ConvertibleToTagUPtr = requires(T t)
@@ -15,6 +22,178 @@ concept ConvertibleToTagUPtr = requires(T t)
 
 class Tag;
 
+/* Name of a tag known at compile time, which is referenced instead of
+   copied. Only constant expressions convert to it, so it can't point into a
+   buffer that goes away before the tag. */
+class TagName
+{
+private:
+    std::string_view m_Name;
+
+public:
+    template<size_t N>
+    consteval TagName(const char (&name)[N]) : m_Name(name, N - 1)
+    {
+
+    }
+
+    std::string_view Get() const
+    {
+        return m_Name;
+    }
+};
+
+/* Bump allocator owned by a document. Nodes and text created through the
+   fluent Tag API are placed in its blocks instead of separate heap
+   allocations. Memory is only returned when the whole pool is destroyed. */
+class TagPool
+{
+private:
+    static constexpr size_t BlockSize = 8192;
+
+    std::vector<std::unique_ptr<std::byte[]>> m_Blocks;
+    size_t m_Used = BlockSize;
+
+public:
+    TagPool() = default;
+
+    TagPool(const TagPool&) = delete;
+    TagPool& operator=(const TagPool&) = delete;
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        /* Oversized requests get a block of their own, the current block
+           stays in use for the following allocations. */
+        if (size > BlockSize / 4)
+        {
+            auto block = std::unique_ptr<std::byte[]>(new std::byte[size]);
+            void* result = block.get();
+            m_Blocks.insert(m_Blocks.end() - (m_Blocks.empty() ? 0 : 1), std::move(block));
+            return result;
+        }
+
+        size_t offset = (m_Used + alignment - 1) & ~(alignment - 1);
+        if (offset + size > BlockSize)
+        {
+            m_Blocks.push_back(std::unique_ptr<std::byte[]>(new std::byte[BlockSize]));
+            offset = 0;
+        }
+
+        m_Used = offset + size;
+        return m_Blocks.back().get() + offset;
+    }
+
+    std::string_view CopyString(std::string_view str)
+    {
+        if (str.empty())
+        {
+            return std::string_view();
+        }
+
+        char* result = (char*)Allocate(str.size(), 1);
+        std::copy(str.begin(), str.end(), result);
+        return std::string_view(result, str.size());
+    }
+};
+
+/* Children are either heap allocated (AddTag with a std::unique_ptr) or
+   placed in a TagPool, in which case only the destructor is run. */
+struct TagDeleter
+{
+    bool m_Pooled = false;
+
+    TagDeleter() = default;
+
+    TagDeleter(bool pooled) : m_Pooled(pooled)
+    {
+
+    }
+
+    template<typename TagType>
+    TagDeleter(const std::default_delete<TagType>&) : m_Pooled(false)
+    {
+
+    }
+
+    void operator()(Tag* tag) const;
+};
+
+using TagPtr = std::unique_ptr<Tag, TagDeleter>;
+
+/* Output buffer used when emitting a Tag tree. The whole tree is written
+   in one pass into a single buffer. If a sink is given, the buffer is handed
+   over to it every time it grows past the chunk size, and then reused. */
+class HtmlWriter
+{
+private:
+    std::string m_Buffer;
+    std::function<void(std::string_view)> m_Sink;
+    size_t m_ChunkSize;
+    std::vector<std::pair<size_t, std::string>> m_Holes;
+
+public:
+    HtmlWriter(size_t reserve = 4096) : m_Sink(nullptr), m_ChunkSize(0)
+    {
+        m_Buffer.reserve(reserve);
+    }
+
+    HtmlWriter(const std::function<void(std::string_view)>& sink, size_t chunkSize = 16384) :
+        m_Sink(sink), m_ChunkSize(chunkSize)
+    {
+        m_Buffer.reserve(chunkSize);
+    }
+
+    HtmlWriter(const HtmlWriter&) = delete;
+    HtmlWriter& operator=(const HtmlWriter&) = delete;
+
+    void Append(std::string_view str)
+    {
+        m_Buffer.append(str);
+        if (m_Sink != nullptr && m_Buffer.size() >= m_ChunkSize)
+        {
+            Flush();
+        }
+    }
+
+    void Append(char c)
+    {
+        m_Buffer.push_back(c);
+        if (m_Sink != nullptr && m_Buffer.size() >= m_ChunkSize)
+        {
+            Flush();
+        }
+    }
+
+    void Flush()
+    {
+        if (m_Sink == nullptr || m_Buffer.empty())
+        {
+            return;
+        }
+
+        m_Sink(m_Buffer);
+        m_Buffer.clear();
+    }
+
+    /* Records a named hole at the current position. Offsets are only
+       meaningful without a sink. */
+    void MarkHole(const std::string& name)
+    {
+        m_Holes.push_back(std::make_pair(m_Buffer.size(), name));
+    }
+
+    const std::vector<std::pair<size_t, std::string>>& GetHoles() const
+    {
+        return m_Holes;
+    }
+
+    /* Only meaningful without a sink, returns everything written so far. */
+    std::string Take()
+    {
+        return std::move(m_Buffer);
+    }
+};
+
 /* TODO */
 class InnerHtml
 {
@@ -43,37 +222,53 @@ class CssClass
 public:
     CssClass(const std::set<std::string>& components) : m_Components(components) {};
     
-    CssClass(const std::string& cssClass) 
+    CssClass(const std::string& cssClass) : CssClass(std::string_view(cssClass)) {}
+
+    CssClass(const char* cssClass) : CssClass(std::string_view(cssClass)) {}
+
+    CssClass(std::string_view cssClass)
     {
-        std::regex regexz("\\s");
-        m_Components = std::set<std::string>(
-            std::sregex_token_iterator(
-                cssClass.begin(), 
-                cssClass.end(), 
-                regexz, 
-                -1),
-            std::sregex_token_iterator());
+        auto isSpace = [](char c)
+            {
+                return std::isspace((unsigned char)c) != 0;
+            };
+
+        auto it = cssClass.begin();
+        while (it != cssClass.end())
+        {
+            auto start = std::find_if_not(it, cssClass.end(), isSpace);
+            it = std::find_if(start, cssClass.end(), isSpace);
+
+            if (start != it)
+            {
+                m_Components.emplace(start, it);
+            }
+        }
     }
-    
-    CssClass(const char* cssClass) : CssClass(std::string(cssClass)) {}
 
     CssClass() = default;
 
     explicit operator std::string() const
     {
-        std::string result = "";
+        HtmlWriter writer;
+        Write(writer);
+        return writer.Take();
+    }
+
+    void Write(HtmlWriter& writer) const
+    {
+        bool first = true;
 
         for (const auto& component : m_Components)
         {
-            result += component + " ";
-        }
+            if (!first)
+            {
+                writer.Append(' ');
+            }
 
-        if (result.length() > 0)
-        {
-            result.erase(result.length() - 1);
+            writer.Append(component);
+            first = false;
         }
-        
-        return result;
     }
 
     operator const std::set<std::string>&() const
@@ -99,10 +294,16 @@ public:
 
 class Tag
 {
+private:
+    /* Declared before the children, so that they are destroyed first. */
+    std::unique_ptr<TagPool> m_OwnedPool;
+    TagPool* m_Pool = nullptr;
+    std::string m_OwnedTagName;
+
 protected:
-    std::string m_TagName;
-    std::list<std::unique_ptr<Tag>> m_Children;
-    std::list<std::pair<std::string, std::string>> m_Properties; 
+    std::string_view m_TagName;
+    std::vector<TagPtr> m_Children;
+    std::vector<std::pair<std::string, std::string>> m_Properties;
 
     CssClass m_CssClass;
 
@@ -110,21 +311,77 @@ protected:
     InnerHtml m_InnerHtml;
     friend class InnerHtml;
 private:
-    Tag* ContentTag(const std::string& tagName, const std::string& content);
+    Tag* ContentTag(TagName tagName, const std::string& content);
+
+    /* Pool of the document this tag belongs to, a standalone tag becomes the
+       owner of a new one. */
+    TagPool& GetPool()
+    {
+        if (m_Pool == nullptr)
+        {
+            m_OwnedPool = std::make_unique<TagPool>();
+            m_Pool = m_OwnedPool.get();
+        }
+
+        return *m_Pool;
+    }
 
 public:
-    Tag(const std::string& name) : m_TagName(name), m_InnerHtml(this)
+    Tag(TagName name) : m_TagName(name.Get()), m_InnerHtml(this)
     {
-    
+
+    }
+
+    /* Any other name is copied. */
+    template<std::same_as<std::string> String>
+    Tag(const String& name) :
+        m_OwnedTagName(name), m_TagName(m_OwnedTagName), m_InnerHtml(this)
+    {
+
     }
 
     virtual ~Tag() = default;
 
+    /* Constructs a child in the pool of this document. Literal names are
+       taken by the overload below, where they are still known to be ones. */
+    template<typename TagType = Tag, typename... Args>
+        requires (!std::is_array_v<std::remove_reference_t<Args>> && ...)
+    TagType* NewTag(Args&&... args)
+    {
+        TagPool& pool = GetPool();
+
+        /* The slot is taken first, so that a constructed child is never
+           left without an owner. */
+        m_Children.emplace_back(nullptr, TagDeleter(true));
+
+        TagType* tag;
+        try
+        {
+            void* memory = pool.Allocate(sizeof(TagType), alignof(TagType));
+            tag = new (memory) TagType(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            m_Children.pop_back();
+            throw;
+        }
+
+        tag->m_Pool = &pool;
+        m_Children.back().reset(tag);
+        return tag;
+    }
+
+    template<typename TagType = Tag>
+    TagType* NewTag(TagName name)
+    {
+        return NewTag<TagType, TagName>(std::move(name));
+    }
+
     template<typename TagType = Tag>
     TagType* AddTag(std::unique_ptr<TagType> tag)
     {
-        auto result = m_Children.insert(m_Children.end(), std::move(tag));
-        return (TagType*)result->get();
+        m_Children.emplace_back(std::move(tag));
+        return (TagType*)m_Children.back().get();
     }
 
     template<typename TagType = Tag, std::convertible_to<std::unique_ptr<TagType>> T>
@@ -136,29 +393,39 @@ public:
     template<typename TagType = Tag>
     TagType* AddTag(const std::string& type)
     {
-        return AddTag(std::make_unique<Tag>(type));
+        return NewTag<TagType>(type);
+    }
+
+    std::string GetPropertyString() const
+    {
+        HtmlWriter writer;
+        WritePropertyString(writer);
+        return writer.Take();
     }
 
-    std::string GetPropertyString()
+    void WritePropertyString(HtmlWriter& writer) const
     {
-        std::string result = "";
-        for (auto kv : m_Properties)
+        for (const auto& kv : m_Properties)
         {
-			if (kv.second == "")
-			{
-				result += " " + kv.first;
-				continue;
-			}
-			
-            result += " " + kv.first + "=\"" + kv.second + "\"";
+            writer.Append(' ');
+            writer.Append(kv.first);
+
+            if (kv.second == "")
+            {
+                continue;
+            }
+
+            writer.Append("=\"");
+            writer.Append(kv.second);
+            writer.Append('"');
         }
 
         if (!m_CssClass->empty())
         {
-            result += " class=\"" + (std::string)m_CssClass + "\"";
+            writer.Append(" class=\"");
+            m_CssClass.Write(writer);
+            writer.Append('"');
         }
-
-        return result;
     }
 
     void AddProperty(const std::string& name, const std::string& value = "")
@@ -181,18 +448,41 @@ public:
         return this->m_Children;
     }
 
-    virtual std::string GetContentString()
+    std::string GetContentString()
     {
         return m_InnerHtml;
     }
 
-    virtual std::string Emit()
+    std::string Emit()
     {
-        std::string result = std::string("<") + m_TagName + GetPropertyString() + ">";
+        HtmlWriter writer;
+        Write(writer);
+        return writer.Take();
+    }
+
+    /* Writes the whole subtree in a single pass. Subclasses with a different
+       representation override this instead of Emit. */
+    virtual void Write(HtmlWriter& writer)
+    {
+        writer.Append('<');
+        writer.Append(m_TagName);
+        WritePropertyString(writer);
+        writer.Append('>');
 
-        result += GetContentString();
+        WriteContent(writer);
 
-        return result + "</" + m_TagName + ">";
+        writer.Append("</");
+        writer.Append(m_TagName);
+        writer.Append('>');
+    }
+
+    void WriteContent(HtmlWriter& writer)
+    {
+        for (auto& child : m_Children)
+        {
+            child->Write(writer);
+            writer.Append('\n');
+        }
     }
 
     void PropertyWrite(const std::string& propertyName, const std::string& value)
@@ -211,6 +501,8 @@ public:
 
     const std::string& PropertyRead(const std::string& propertyName)
     {
+        static const std::string Empty = "";
+
         for (auto& property : m_Properties)
         {
             if (property.first == propertyName)
@@ -219,27 +511,27 @@ public:
             }
         }
 
-        return "";
+        return Empty;
     }
 
     static auto Html()
     {
-        return std::make_unique<Tag>("html");
+        return std::make_unique<Tag>(TagName("html"));
     }
 
     Tag* Head()
     {
-        return AddTag(std::make_unique<Tag>("head"));
+        return NewTag("head");
     }
 
     Tag* Body()
     {
-        return AddTag(std::make_unique<Tag>("body"));
+        return NewTag("body");
     }
 
     Tag* Div()
     {
-        return AddTag(std::make_unique<Tag>("div"));
+        return NewTag("div");
     }
 
     Tag* P(const std::string& content = "")
@@ -249,12 +541,12 @@ public:
 
     Tag* Form()
     {
-        return AddTag(std::make_unique<Tag>("form"));
+        return NewTag("form");
     }
 
     Tag* Form(const std::string& action)
     {
-        auto result = AddTag(std::make_unique<Tag>("form"));
+        auto result = NewTag("form");
         result->AddProperty("action", action);
 
         return result;
@@ -272,13 +564,16 @@ public:
 
             }
 
-            std::string Emit() override
+            void Write(HtmlWriter& writer) override
             {
-                return std::string("<") + m_TagName + GetPropertyString() + ">";
+                writer.Append('<');
+                writer.Append(m_TagName);
+                WritePropertyString(writer);
+                writer.Append('>');
             }
         };
         
-        auto result = AddTag(std::make_unique<InputTag>());
+        auto result = NewTag<InputTag>();
         result->AddProperty("name", name);
         result->AddProperty("type", type);
 
@@ -300,13 +595,15 @@ public:
 
             }
 
-            std::string Emit() override
+            void Write(HtmlWriter& writer) override
             {
-                return "<" + m_TagName + ">";
+                writer.Append('<');
+                writer.Append(m_TagName);
+                writer.Append('>');
             }
         };
 
-        return AddTag(std::make_unique<BrTag>());
+        return NewTag<BrTag>();
     }
 
     Tag* Label(const std::string& forName, const std::string& content)
@@ -325,7 +622,7 @@ public:
 
     Tag* Meta()
     {
-        return AddTag(std::make_unique<Tag>("meta"));
+        return NewTag("meta");
     }
 
     Tag* Link(const std::string& href, const std::string& rel);
@@ -339,7 +636,7 @@ public:
 
     Tag* Script()
     {
-        return AddTag(std::make_unique<Tag>("script"));
+        return NewTag("script");
     }
 
     Tag* Text(const std::string& content = "")
@@ -379,7 +676,7 @@ public:
 
     Tag* Img(const std::string& src, const std::string& alt = "", const std::string& width = "", const std::string& height = "")
     {
-        auto img = std::make_unique<Tag>("img");
+        auto img = NewTag("img");
         img->AddProperty("src", src);
         if (alt != "")
         {
@@ -394,7 +691,7 @@ public:
             img->AddProperty("height", height);
         }
 
-        return AddTag(std::move(img));
+        return img;
     }
 
     Tag* Button(const std::string& text, const std::string& onClick = "")
@@ -414,75 +711,123 @@ public:
         return ContentTag("style", content);
     }
 
+    /* Placeholder filled in at render time, see HtmlTemplate. */
+    Tag* Hole(const std::string& name)
+    {
+        class HoleTag : public Tag
+        {
+        public:
+            HoleTag(const std::string& name) : Tag(name)
+            {
+
+            }
+
+            void Write(HtmlWriter& writer) override
+            {
+                writer.MarkHole(std::string(m_TagName));
+            }
+        };
+
+        return NewTag<HoleTag>(name);
+    }
+
     void AddContent(const std::string& content);
 };
 
 class TextContent : public Tag
 {
 private:
-    std::string m_Text;
+    std::string m_OwnedText;
+    std::string_view m_Text;
+public:
+    TextContent(const std::string& text) : Tag(""),
+        m_OwnedText(text), m_Text(m_OwnedText)
+    {
+
+    }
+
+    /* The text has to outlive the node, used for text copied into a TagPool. */
+    TextContent(std::string_view text) : Tag(""), m_Text(text)
+    {
+
+    }
+
+    void Write(HtmlWriter& writer) override
+    {
+        writer.Append(m_Text);
+    }
+};
+
+/* Emits only its children, used to return several tags as one subtree. */
+class Fragment : public Tag
+{
 public:
-    TextContent(const std::string& text) : m_Text(text), 
-        Tag("")
+    Fragment() : Tag("")
     {
 
     }
 
-    std::string Emit() override
+    void Write(HtmlWriter& writer) override
     {
-        return m_Text;
+        WriteContent(writer);
     }
 };
 
 inline InnerHtml::operator std::string() const
 {
-    std::string result = "";
+    HtmlWriter writer;
+    m_Tag->WriteContent(writer);
+    return writer.Take();
+}
 
-    for (auto& child : m_Tag->m_Children)
+inline void TagDeleter::operator()(Tag* tag) const
+{
+    if (m_Pooled)
     {
-        result += child->Emit() + "\n";
+        tag->~Tag();
+        return;
     }
 
-    return result;
+    delete tag;
 }
 
 inline void Tag::AddContent(const std::string& content)
 {
-    AddTag((std::unique_ptr<Tag>)std::make_unique<TextContent>(content));
+    NewTag<TextContent>(GetPool().CopyString(content));
 }
 
-inline Tag* Tag::ContentTag(const std::string& tagName, const std::string& content)
+inline Tag* Tag::ContentTag(TagName tagName, const std::string& content)
 {
-    auto text = std::make_unique<Tag>(tagName);
+    auto text = NewTag(tagName);
 
     if (content != "")
     {
         text->AddContent(content);
     }
 
-    return AddTag(std::move(text));
+    return text;
 }
 
 inline Tag* Tag::Link(const std::string& href, const std::string& rel)
 {
-    auto text = std::make_unique<Tag>("link");
+    auto text = NewTag("link");
     text->PropertyWrite("href", href);
     text->PropertyWrite("rel", rel);
 
-    return AddTag(std::move(text));
+    return text;
 }
 
 inline Tag* Tag::A(const std::string& href, const std::string& content)
 {
-    auto text = std::make_unique<Tag>("a");
+    auto text = NewTag("a");
     text->PropertyWrite("href", href);
 
     if (content != "")
     {
-        text->AddTag((std::unique_ptr<Tag>)std::make_unique<TextContent>(content));
+        text->AddContent(content);
     }
 
-    return AddTag(std::move(text));
+    return text;
 }
 
 class Pseudotag
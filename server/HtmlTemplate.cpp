@@ -0,0 +1,32 @@
+#include "HtmlTemplate.hpp"
+
+HtmlTemplate::HtmlTemplate(Tag& root)
+{
+    HtmlWriter writer;
+    root.Write(writer);
+
+    std::string html = writer.Take();
+    size_t segmentStart = 0;
+
+    for (const auto& hole : writer.GetHoles())
+    {
+        m_Segments.push_back(html.substr(segmentStart, hole.first - segmentStart));
+        m_Holes.push_back(hole.second);
+        segmentStart = hole.first;
+    }
+
+    m_Segments.push_back(html.substr(segmentStart));
+    m_StaticSize = html.size();
+}
+
+void HtmlTemplate::Render(HtmlWriter& writer,
+                          const std::function<void(size_t holeIndex, HtmlWriter& writer)>& fill) const
+{
+    for (size_t i = 0; i < m_Holes.size(); i++)
+    {
+        writer.Append(m_Segments[i]);
+        fill(i, writer);
+    }
+
+    writer.Append(m_Segments.back());
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Html.hpp"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+/* A Tag tree emitted once and split at its Hole tags into static segments.
+   Rendering only copies the segments and writes whatever is supplied for
+   each hole, no tree is built for the static parts. */
+class HtmlTemplate
+{
+private:
+    std::vector<std::string> m_Segments;
+    std::vector<std::string> m_Holes;
+    size_t m_StaticSize = 0;
+
+public:
+    HtmlTemplate(Tag& root);
+
+    const std::vector<std::string>& GetHoles() const
+    {
+        return m_Holes;
+    }
+
+    size_t GetStaticSize() const
+    {
+        return m_StaticSize;
+    }
+
+    void Render(HtmlWriter& writer,
+                const std::function<void(size_t holeIndex, HtmlWriter& writer)>& fill) const;
+};
@@ -124,6 +124,8 @@ std::string StringifyHttpCode(int code)
         return "Forbidden";
     case 404:
         return "Not Found";
+    case 413:
+        return "Payload Too Large";
     case 500:
         return "Internal Server Error";
     case 501:
@@ -137,8 +139,22 @@ std::string StringifyHttpCode(int code)
     }
 }
 
+StaticResponse::StaticResponse(HttpResponse& response) :
+    m_Data(response.GetResponseHeader()),
+    m_HttpCode(response.GetHttpCode()),
+    m_ContentType(response.GetContentType())
+{
+    m_HeaderSize = m_Data.size();
+    m_Data += response.GetContent() + "\r\n";
+}
+
 std::string HttpResponse::GetResponseHeader() const
 {
+    if (m_Static != nullptr)
+    {
+        return std::string(m_Static->GetHeader());
+    }
+
     std::string result =
         "HTTP/1.1 " + std::to_string(GetHttpCode()) + " " + 
         StringifyHttpCode(GetHttpCode()) + "\r\n";
@@ -154,6 +170,11 @@ std::string HttpResponse::GetResponseHeader() const
 
 std::string HttpResponse::GetContentType() const
 {
+    if (m_Static != nullptr)
+    {
+        return m_Static->m_ContentType;
+    }
+
     if (m_Headers.contains("Content-Type"))
     {
         return m_Headers.at("Content-Type");
@@ -163,14 +184,80 @@ std::string HttpResponse::GetContentType() const
 
 std::string HttpResponse::GetContent()
 {
+    if (m_Static != nullptr)
+    {
+        return m_Static->m_Data.substr(
+            m_Static->m_HeaderSize,
+            m_Static->m_Data.size() - m_Static->m_HeaderSize - 2);
+    }
+
     return this->m_ContentPromise->Fulfill();
 }
 
 std::string HttpResponse::GetResponse()
 {
+    if (m_Static != nullptr)
+    {
+        return m_Static->m_Data;
+    }
+
     return GetResponseHeader() + GetContent() + "\r\n";
 }
 
+void HttpResponse::Send(Connection& connection, bool includeContent)
+{
+    constexpr size_t SendChunkSize = 16384;
+
+    if (m_Static != nullptr)
+    {
+        connection.SendString(includeContent ? m_Static->m_Data : m_Static->GetHeader());
+        return;
+    }
+
+    std::string buffer = GetResponseHeader();
+
+    if (!includeContent)
+    {
+        connection.SendString(buffer);
+        return;
+    }
+
+    buffer.reserve(SendChunkSize);
+
+    /* The header has to go out first, the promise writes to the connection
+       directly. */
+    if (m_ContentPromise->CanTransmit())
+    {
+        connection.SendString(buffer);
+        m_ContentPromise->Transmit(connection);
+        connection.SendString("\r\n");
+        return;
+    }
+
+    m_ContentPromise->Stream(
+        [&](std::string_view chunk)
+        {
+            /* Large chunks go out directly, small ones are coalesced with the
+               header and each other. */
+            if (buffer.size() + chunk.size() >= SendChunkSize)
+            {
+                connection.SendString(buffer);
+                buffer.clear();
+
+                if (chunk.size() >= SendChunkSize)
+                {
+                    connection.SendString(chunk);
+                    return;
+                }
+            }
+
+            buffer.append(chunk);
+        });
+
+    buffer += "\r\n";
+    connection.SendString(buffer);
+}
+
 Request::Request(Connection&& connection) :
     m_Connection(std::move(connection)),
     m_Data("")
@@ -4,8 +4,11 @@
 #include <time.h>
 #include <map>
 #include <memory>
+#include <functional>
+#include <string_view>
 
 #include "Connection.hpp"
+#include "BodySpool.hpp"
 
 std::string StringifyHttpCode(int code);
 
@@ -49,8 +52,19 @@ struct Request
     Request(Connection&& connection);
 
     std::string m_Data;
-    Connection m_Connection;
+
+    /* Responders that stream the body receive the rest of it from here. */
+    mutable Connection m_Connection;
     std::string_view m_Body;
+
+    /* Holds the body instead of m_Body when it was too large to be kept in
+       memory. */
+    std::unique_ptr<SpooledBody> m_SpooledBody;
+
+    /* Bytes of the body still to be received from the connection, only
+       ever left to responders that stream the body. */
+    size_t m_BodyLeft = 0;
+
     ResourceIdentifier m_ResourceId;
     std::string m_Protocol;
     std::map<std::string, std::string> m_RequestHeaders;
@@ -59,11 +73,31 @@ struct Request
     std::map<std::string, std::string> GetCookies() const;
 };
 
+using ContentSink = std::function<void(std::string_view)>;
+
 class ContentPromise
 {
 public:
     virtual ~ContentPromise() = default;
     virtual std::string Fulfill() = 0;
+
+    /* Passes the content to the sink, possibly in multiple chunks. Promises
+       that can produce their content incrementally should override this. */
+    virtual void Stream(const ContentSink& sink)
+    {
+        sink(Fulfill());
+    }
+
+    /* Promises that can send their content straight to the connection, e.g.
+       with sendfile, return true and implement Transmit. */
+    virtual bool CanTransmit() const
+    {
+        return false;
+    }
+
+    virtual void Transmit([[maybe_unused]] Connection& connection)
+    {
+    }
 };
 
 class StrContentPromise : public ContentPromise
@@ -80,12 +114,33 @@ public:
     }
 };
 
+class HttpResponse;
+
+/* A response serialized once, header and body, and shared by every request
+   it is sent for. */
+struct StaticResponse
+{
+    std::string m_Data;
+    size_t m_HeaderSize;
+    int m_HttpCode;
+    std::string m_ContentType;
+
+    StaticResponse(HttpResponse& response);
+
+    std::string_view GetHeader() const
+    {
+        return std::string_view(m_Data).substr(0, m_HeaderSize);
+    }
+};
+
 class HttpResponse
 {
 private:
     std::unique_ptr<ContentPromise> m_ContentPromise;
+    std::shared_ptr<const StaticResponse> m_Static;
     int m_HttpCode;
 public:
+    /* Ignored for responses created from a StaticResponse. */
     std::map<std::string, std::string> m_Headers;
 
     template<typename T>
@@ -105,6 +160,10 @@ public:
         m_ContentPromise(std::move(content)), 
         m_HttpCode(httpCode) {}
 
+    inline HttpResponse(const std::shared_ptr<const StaticResponse>& response) :
+        m_Static(response),
+        m_HttpCode(response->m_HttpCode) {}
+
     std::string GetContent();
 
     std::string GetContentType() const;
@@ -117,4 +176,7 @@ public:
     std::string GetResponseHeader() const;
 
     std::string GetResponse();
+
+    /* Sends the response without assembling it in memory first. */
+    void Send(Connection& connection, bool includeContent = true);
 };
\ No newline at end of file
@@ -21,7 +21,13 @@
 #include "IndexPage.hpp"
 #include "ErrorPage.hpp"
 #include "UploadApi.hpp"
+#include "FileTransfer.hpp"
+#include "ContentStore.hpp"
+#include "UploadQuota.hpp"
 #include "LoginApi.hpp"
+#include "SessionStore.hpp"
+#include "SessionToken.hpp"
+#include "SharedSessionStore.hpp"
 #include "LoginPage.hpp"
 #include "StringHelper.hpp"
 
@@ -88,6 +94,11 @@ std::thread HttpService::Run()
 
 HttpResponse HttpService::GetResponse(const Request& request) const
 {
+    /* Rendered once and shared by all services. */
+    static const Responder NotImplemented = ErrorPage(501);
+    static const Responder NotFound = ErrorPage(404);
+    static const Responder InternalServerError = ErrorPage(500);
+
     assert(request.m_ResourceId.GetPathParts().size() > 0);
     std::vector<std::string> pathParts = request.m_ResourceId.GetPathParts();
 
@@ -97,25 +108,15 @@ HttpResponse HttpService::GetResponse(const Request& request) const
 
     if (m_Responders.count(request.m_Method) == 0)
     {
-        return ErrorPage(501)(request);
+        return NotImplemented(request);
     }
 
     if (m_Responders.at(request.m_Method).count(pathParts[0]) == 0)
     {
-        return ErrorPage(404)(request);
+        return NotFound(request);
     }
 
-    auto responderIt = m_Responders.at(request.m_Method).find(pathParts[0]);
-
-    const Responder* responder = 
-        responderIt == m_Responders.at(request.m_Method).end() ?
-            nullptr : 
-            &responderIt->second;
-
-    for (size_t i = 1; i < pathParts.size() && responder != nullptr; i++)
-    {
-        responder = responder->GetChild(pathParts[i]);
-    }
+    const Responder* responder = FindResponder(request);
 
     if (responder == nullptr)
     {
@@ -129,12 +130,46 @@ HttpResponse HttpService::GetResponse(const Request& request) const
 
     try
     {
-        return responder->m_Respond(request);
+        return (*responder)(request);
     }
     catch (const std::runtime_error& e)
     {
-        return ErrorPage(500)(request);
+        return InternalServerError(request);
+    }
+}
+
+const Responder* HttpService::FindResponder(const Request& request) const
+{
+    std::vector<std::string> pathParts = request.m_ResourceId.GetPathParts();
+
+    auto methodIt = m_Responders.find(request.m_Method);
+    if (methodIt == m_Responders.end() || pathParts.empty())
+    {
+        return nullptr;
+    }
+
+    auto responderIt = methodIt->second.find(pathParts[0]);
+
+    const Responder* responder = 
+        responderIt == methodIt->second.end() ?
+            nullptr : 
+            &responderIt->second;
+
+    for (size_t i = 1; i < pathParts.size() && responder != nullptr; i++)
+    {
+        responder = responder->GetChild(pathParts[i]);
     }
+
+    return responder;
+}
+
+bool HttpService::StreamsBody(const Request& request) const
+{
+    const Responder* responder = FindResponder(request);
+
+    return responder != nullptr &&
+           responder->m_StreamsBody != nullptr &&
+           responder->m_StreamsBody(request);
 }
 
 void HttpClientWorker::WorkerFunction(Connection&& originalConnection)
@@ -143,6 +178,16 @@ void HttpClientWorker::WorkerFunction(Connection&& originalConnection)
     std::string data = "";
     WorkerCounterAcquirer acquirer;
 
+    try
+    {
+        connection.Establish();
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "[E] " << connection.GetAddress().ToString() << ": " << error.what() << "\n";
+        return;
+    }
+
     std::cout << WorkerCounterAcquirer::GetNumberOfThreadsRef() << " threads started\n";
 
     auto headersEnd = std::string::npos;
@@ -205,12 +250,13 @@ void HttpClientWorker::WorkerFunction(Connection&& originalConnection)
         }
     }
 
-    contentLeft -= data.length() - headers.length() - 4;
-    while (contentLeft > 0)
+    /* A client that sends more than its Content-Length is answered with an
+       error rather than letting what is left of the body wrap around. */
+    size_t bodyReceived = data.length() - headersEnd - 4;
+    bool bodyTooLong = bodyReceived > contentLeft;
+    if (!bodyTooLong)
     {
-        std::string got = connection.ReceiveString(std::min(contentLeft, (size_t)4096));
-        contentLeft -= got.length();
-        data += got;
+        contentLeft -= bodyReceived;
     }
 
     auto spaceFirst = data.find(' ');
@@ -227,9 +273,13 @@ void HttpClientWorker::WorkerFunction(Connection&& originalConnection)
     std::string skipMethod =
         std::string(
             data.begin() + method.length() + 1,
-            data.end());
+            data.begin() + headersEnd);
 
     auto it = std::find(skipMethod.begin(), skipMethod.end(), ' ');
+    if (it == skipMethod.end())
+    {
+        return;
+    }
 
     ResourceIdentifier resourceId(std::string(skipMethod.begin(), it));
     std::string protocol = std::string(it + 1, skipMethod.end());
@@ -243,22 +293,114 @@ void HttpClientWorker::WorkerFunction(Connection&& originalConnection)
 
     Request request(std::move(connection));
 
-    request.m_Data = data;
     request.m_ResourceId = resourceId;
     request.m_Method = method;
     request.m_Protocol = protocol;
     request.m_RequestHeaders = std::move(headerMap);
-    request.m_Body = std::string_view(data.begin() + headersEnd + 4, data.end());
+
+    if (bodyTooLong)
+    {
+        std::cerr << "[!] " << request.m_Connection.GetAddress().ToString()
+                  << ": body longer than its Content-Length\n";
+
+        HttpResponse response = ErrorPage(400)(request);
+        response.Send(request.m_Connection, request.m_Method != "HEAD");
+        return;
+    }
+
+    request.m_BodyLeft = contentLeft;
+
+    BodyMemory bodyMemory;
+
+    /* The request line and the headers are known, a responder that streams
+       the body takes the rest of it from the connection. */
+    if (contentLeft == 0 || !m_Service.StreamsBody(request))
+    {
+        request.m_BodyLeft = 0;
+
+        try
+        {
+            /* Large bodies, and any once the bodies of other requests take
+               the whole budget, are spooled to a file instead. */
+            size_t bodySize = data.length() - headersEnd - 4 + contentLeft;
+            if (contentLeft > 0 && (bodySize > InMemoryBodyLimit || !bodyMemory.Reserve(bodySize)))
+            {
+                request.m_SpooledBody = std::make_unique<SpooledBody>();
+                request.m_SpooledBody->Write(std::string_view(data).substr(headersEnd + 4));
+                data.resize(headersEnd + 4);
+            }
+
+            while (contentLeft > 0)
+            {
+                std::string got = request.m_Connection.ReceiveString(std::min(contentLeft, (size_t)65536));
+                if (got.empty())
+                {
+                    return;
+                }
+
+                contentLeft -= got.length();
+
+                if (request.m_SpooledBody != nullptr)
+                {
+                    request.m_SpooledBody->Write(got);
+                }
+                else
+                {
+                    data += got;
+                }
+            }
+        }
+        catch (const std::runtime_error& error)
+        {
+            std::cerr << "[E] " << request.m_Connection.GetAddress().ToString() << ": " << error.what() << "\n";
+            return;
+        }
+    }
+
+    request.m_Data = std::move(data);
+    request.m_Body = std::string_view(request.m_Data).substr(headersEnd + 4);
 
     HttpResponse response = m_Service.GetResponse(request);
-    if (request.m_Method == "HEAD")
+    response.Send(request.m_Connection, request.m_Method != "HEAD");
+}
+
+/* SESSION_BACKEND selects where sessions are kept: "store", the default,
+   keeps them in this process and persists them across restarts. "tokens"
+   keeps them in signed cookies, servers given the same SESSION_SECRET
+   accept each other's. "shared" keeps them in a shared memory segment,
+   named by SESSION_SEGMENT, for all the server processes on the host. */
+static void SelectSessionBackend()
+{
+    const char* selected = getenv("SESSION_BACKEND");
+    std::string backend = selected != nullptr ? selected : "store";
+
+    if (backend == "store")
+    {
+        /* Sessions from before a restart are available once accepting
+           begins. */
+        SessionStore::Get().EnablePersistence("sessions");
+    }
+    else if (backend == "tokens")
+    {
+        const char* secret = getenv("SESSION_SECRET");
+        if (secret == nullptr)
+        {
+            std::cerr << "[!] SESSION_SECRET isn't set, tokens won't be accepted by other servers\n";
+        }
+
+        SessionBackend::Set(std::make_shared<SessionTokens>(secret != nullptr ? secret : ""));
+    }
+    else if (backend == "shared")
     {
-        request.m_Connection.SendString(response.GetResponseHeader());
+        const char* segment = getenv("SESSION_SEGMENT");
+        SessionBackend::Set(std::make_shared<SharedSessionStore>(segment != nullptr ? segment : "/server-sessions"));
     }
     else
     {
-        request.m_Connection.SendString(response.GetResponse());
+        throw std::runtime_error("Unknown session backend " + backend);
     }
+
+    std::cout << "[*] Keeping sessions in the " << backend << " backend\n";
 }
 
 int main()
@@ -282,21 +424,38 @@ int main()
     try
     {
         HttpService httpService = HttpService("0.0.0.0", 80);
+        UploadApi uploadApi;
+
         httpService.m_Responders["GET"] =
         {
             { "/", IndexPage() },
             { "/index.html", Alias(httpService, "/") },
-            { "/login", LoginPage() }
+            { "/login", LoginPage() },
+            { "/uploadFile", UploadFileApi() }
+        };
+
+        httpService.m_Responders["HEAD"] =
+        {
+            { "/uploadFile", UploadFileApi() }
         };
 
         httpService.m_Responders["POST"] =
         {
-            { "/upload", UploadApi() },
+            { "/upload", uploadApi },
             { "/uploadFile", UploadFileApi() },
+            { "/uploadArchive", UploadArchiveApi(uploadApi.m_ServerUploadDirectory) },
             { "/login", LoginApi() },
         };
         httpService.m_GeneralFallbackResponder = Alias(httpService, "/");
 
+        SelectSessionBackend();
+        ContentStore::Get().Enable(uploadApi.m_ServerUploadDirectory);
+        UploadQuota::Get().Enable(uploadApi.m_ServerUploadDirectory, GlobalUploadQuota, UserUploadQuota);
+
+        /* Restored transfers may complete right away, the index and the
+           quotas have to be open by then. */
+        TransferRegistry::EnablePersistence(uploadApi.m_ServerUploadDirectory);
+
         std::thread t2 = httpService.Run();
 
         //t1.join();
@@ -11,20 +11,68 @@
 #include <thread>
 #include <semaphore>
 #include <memory>
+#include <atomic>
 
 #include "ErrorPage.hpp"
 
 using namespace InetSocketWrapper;
 
+/* Responders whose output never depends on the request can declare it with
+   a `bool IsStatic() const` method. They are then invoked once and the result
+   is reused, pre-serialized, for every later request. */
+template<typename T>
+concept StaticCapable = requires(const T t)
+{
+    { t.IsStatic() } -> std::convertible_to<bool>;
+};
+
+/* Responders that can take a request body straight from the connection
+   declare it with a `bool StreamsBody(const Request&) const` method. If it
+   returns true for a request, the request reaches them with only the part
+   of the body that arrived along with the headers, and m_BodyLeft bytes of
+   it still to be received. */
+template<typename T>
+concept BodyStreamCapable = requires(const T t, const Request& request)
+{
+    { t.StreamsBody(request) } -> std::convertible_to<bool>;
+};
+
 struct Responder
 {
     std::function<HttpResponse(const Request& request)> m_Respond;
+    std::function<bool(const Request& request)> m_StreamsBody = nullptr;
     std::function<const Responder*(const std::string&)> m_ChildrenOverride = nullptr;
     std::map<std::string, Responder> m_Children;
 
+    /* Shared between the copies of a static responder, null otherwise. */
+    std::shared_ptr<std::atomic<std::shared_ptr<const StaticResponse>>> m_StaticCache = nullptr;
+
     HttpResponse operator()(const Request& request) const
     {
-        return this->m_Respond(request);
+        if (m_StaticCache == nullptr)
+        {
+            return this->m_Respond(request);
+        }
+
+        auto cached = m_StaticCache->load();
+        if (cached == nullptr)
+        {
+            HttpResponse response = this->m_Respond(request);
+
+            /* Responders leave the content out for HEAD, which mustn't be
+               what later requests get. */
+            if (request.m_Method == "HEAD")
+            {
+                return response;
+            }
+
+            /* Concurrent first requests may both render it, either result
+               is fine. */
+            cached = std::make_shared<const StaticResponse>(response);
+            m_StaticCache->store(cached);
+        }
+
+        return HttpResponse(cached);
     }
 
     HttpResponse Respond(const Request& request) const
@@ -49,6 +97,21 @@ struct Responder
     template<typename T>
     Responder(T respond) : m_Respond(respond)
     { 
+        if constexpr (StaticCapable<T>)
+        {
+            if (respond.IsStatic())
+            {
+                m_StaticCache = std::make_shared<std::atomic<std::shared_ptr<const StaticResponse>>>();
+            }
+        }
+
+        if constexpr (BodyStreamCapable<T>)
+        {
+            m_StreamsBody = [respond](const Request& request)
+                {
+                    return respond.StreamsBody(request);
+                };
+        }
     }
 
     Responder() = default;
@@ -74,6 +137,11 @@ struct Redirect
 
     Redirect(const std::string& to) : m_To(to) {}
 
+    bool IsStatic() const
+    {
+        return true;
+    }
+
     HttpResponse operator()(const Request& request)
     {
         HttpResponse response("Moved to " + m_To, 301);
@@ -97,6 +165,14 @@ struct HttpService
     HttpService(const std::string& interfce, uint16_t port = 80, InternetProtocol protocol = IPv4);
 
     HttpResponse GetResponse(const Request& request) const;
+
+    /* Null if no responder matches, fallbacks aside. */
+    const Responder* FindResponder(const Request& request) const;
+
+    /* True if the responder of the request takes the rest of its body from
+       the connection itself. */
+    bool StreamsBody(const Request& request) const;
+
     std::thread Run();
 };
 
@@ -0,0 +1,843 @@
+#include "Https.hpp"
+
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <algorithm>
+#include <utility>
+
+static const unsigned char SessionIdContext[] = "BacppkEnd";
+
+static std::atomic<int64_t> OpenSslMemory = 0;
+static std::atomic<bool> OpenSslAllocatorInstalled = false;
+
+/* Every allocation is prefixed with its size. */
+constexpr size_t AllocationHeader = alignof(std::max_align_t);
+
+/* With SSL_MODE_RELEASE_BUFFERS, OpenSSL allocates the record buffers of a
+   connection when it has data to read or write and frees them once it is
+   idle again. Those are all about 16 kB, so every allocation in that range
+   gets a block of the largest size, and freed blocks are kept in a pool
+   shared by all connections instead of going back to malloc. */
+namespace RecordBufferPool
+{
+    constexpr size_t MinSize = 16 * 1024;
+    constexpr size_t BlockSize = 17 * 1024;
+    constexpr size_t MaxPooled = 256;
+
+    static std::mutex Mutex;
+    static std::vector<unsigned char*> Blocks;
+    static std::atomic<int64_t> PooledMemory = 0;
+
+    static bool Contains(size_t size)
+    {
+        return size >= MinSize && size <= BlockSize;
+    }
+
+    static unsigned char* Allocate()
+    {
+        {
+            std::lock_guard guard(Mutex);
+
+            if (!Blocks.empty())
+            {
+                unsigned char* block = Blocks.back();
+                Blocks.pop_back();
+                PooledMemory -= BlockSize;
+                return block;
+            }
+        }
+
+        return (unsigned char*)malloc(BlockSize + AllocationHeader);
+    }
+
+    static void Free(unsigned char* block)
+    {
+        {
+            std::lock_guard guard(Mutex);
+
+            if (Blocks.size() < MaxPooled)
+            {
+                Blocks.push_back(block);
+                PooledMemory += BlockSize;
+                return;
+            }
+        }
+
+        free(block);
+    }
+}
+
+static void* PooledMalloc(size_t size, const char*, int)
+{
+    auto memory = RecordBufferPool::Contains(size) ?
+        RecordBufferPool::Allocate() :
+        (unsigned char*)malloc(size + AllocationHeader);
+    if (memory == nullptr)
+    {
+        return nullptr;
+    }
+
+    *(size_t*)memory = size;
+    OpenSslMemory += size;
+    return memory + AllocationHeader;
+}
+
+static void PooledFree(void* pointer, const char*, int)
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+
+    auto memory = (unsigned char*)pointer - AllocationHeader;
+    size_t size = *(size_t*)memory;
+    OpenSslMemory -= size;
+
+    if (RecordBufferPool::Contains(size))
+    {
+        RecordBufferPool::Free(memory);
+    }
+    else
+    {
+        free(memory);
+    }
+}
+
+static void* PooledRealloc(void* pointer, size_t size, const char* file, int line)
+{
+    if (pointer == nullptr)
+    {
+        return PooledMalloc(size, file, line);
+    }
+
+    if (size == 0)
+    {
+        PooledFree(pointer, file, line);
+        return nullptr;
+    }
+
+    auto memory = (unsigned char*)pointer - AllocationHeader;
+    size_t oldSize = *(size_t*)memory;
+    bool oldPooled = RecordBufferPool::Contains(oldSize);
+    bool newPooled = RecordBufferPool::Contains(size);
+
+    if (oldPooled && newPooled)
+    {
+        *(size_t*)memory = size;
+        OpenSslMemory += (int64_t)size - (int64_t)oldSize;
+        return pointer;
+    }
+
+    if (oldPooled || newPooled)
+    {
+        void* result = PooledMalloc(size, file, line);
+        if (result == nullptr)
+        {
+            return nullptr;
+        }
+
+        std::memcpy(result, pointer, std::min(size, oldSize));
+        PooledFree(pointer, file, line);
+        return result;
+    }
+
+    auto result = (unsigned char*)realloc(memory, size + AllocationHeader);
+    if (result == nullptr)
+    {
+        return nullptr;
+    }
+
+    *(size_t*)result = size;
+    OpenSslMemory += (int64_t)size - (int64_t)oldSize;
+    return result + AllocationHeader;
+}
+
+/* Scratch space of SslConnection::Read, the data is copied out right away. */
+constexpr size_t ReadBufferSize = 16384;
+static thread_local char ReadBuffer[ReadBufferSize];
+
+SslSessionCache::SslSessionCache(size_t capacity, size_t shards)
+{
+    if (shards == 0)
+    {
+        shards = 1;
+    }
+
+    m_ShardCapacity = std::max<size_t>(capacity / shards, 1);
+
+    for (size_t i = 0; i < shards; i++)
+    {
+        m_Shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+SslSessionCache::Shard& SslSessionCache::GetShard(const std::string& id)
+{
+    return *m_Shards[std::hash<std::string>{}(id) % m_Shards.size()];
+}
+
+void SslSessionCache::Add(const std::string& id,
+                          std::vector<unsigned char>&& data,
+                          std::chrono::steady_clock::duration timeout)
+{
+    Shard& shard = GetShard(id);
+    std::lock_guard guard(shard.m_Mutex);
+
+    /* The order queue may also hold sessions that were already removed or
+       replaced, those are recognized by their sequence number. */
+    while (!shard.m_Order.empty() &&
+           (shard.m_Sessions.size() >= m_ShardCapacity ||
+            shard.m_Order.size() > 2 * m_ShardCapacity))
+    {
+        auto& oldest = shard.m_Order.front();
+
+        auto it = shard.m_Sessions.find(oldest.first);
+        if (it != shard.m_Sessions.end() && it->second.m_Sequence == oldest.second)
+        {
+            shard.m_Sessions.erase(it);
+        }
+
+        shard.m_Order.pop_front();
+    }
+
+    uint64_t sequence = shard.m_Sequence++;
+    shard.m_Sessions[id] = Entry{ std::move(data), std::chrono::steady_clock::now() + timeout, sequence };
+    shard.m_Order.push_back(std::make_pair(id, sequence));
+}
+
+bool SslSessionCache::Find(const std::string& id, std::vector<unsigned char>& data)
+{
+    Shard& shard = GetShard(id);
+    std::lock_guard guard(shard.m_Mutex);
+
+    auto it = shard.m_Sessions.find(id);
+    if (it == shard.m_Sessions.end())
+    {
+        return false;
+    }
+
+    if (it->second.m_Expiration < std::chrono::steady_clock::now())
+    {
+        shard.m_Sessions.erase(it);
+        return false;
+    }
+
+    data = it->second.m_Data;
+    return true;
+}
+
+void SslSessionCache::Remove(const std::string& id)
+{
+    Shard& shard = GetShard(id);
+    std::lock_guard guard(shard.m_Mutex);
+
+    shard.m_Sessions.erase(id);
+}
+
+SslTicketKeys::SslTicketKeys(std::chrono::seconds lifetime, SslStatistics& statistics) :
+    m_Lifetime(lifetime), m_Statistics(statistics), m_Current(Generate())
+{
+}
+
+SslTicketKeys::Key SslTicketKeys::Generate()
+{
+    Key key;
+
+    if (RAND_bytes(key.m_Name, sizeof(key.m_Name)) <= 0 ||
+        RAND_bytes(key.m_AesKey, sizeof(key.m_AesKey)) <= 0 ||
+        RAND_bytes(key.m_HmacKey, sizeof(key.m_HmacKey)) <= 0)
+    {
+        throw std::runtime_error("Couldn't generate a session ticket key");
+    }
+
+    key.m_Created = std::chrono::steady_clock::now();
+    return key;
+}
+
+SslTicketKeys::Key SslTicketKeys::GetCurrent()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    {
+        std::shared_lock guard(m_Mutex);
+
+        if (now - m_Current.m_Created < m_Lifetime)
+        {
+            return m_Current;
+        }
+    }
+
+    std::unique_lock guard(m_Mutex);
+
+    /* Another thread might have rotated it in the meantime. */
+    if (now - m_Current.m_Created >= m_Lifetime)
+    {
+        m_Previous = m_Current;
+        m_HasPrevious = true;
+        m_Current = Generate();
+        m_Statistics.m_TicketKeyRotations++;
+    }
+
+    return m_Current;
+}
+
+int SslTicketKeys::Find(const unsigned char* name, Key& key)
+{
+    std::shared_lock guard(m_Mutex);
+
+    if (memcmp(name, m_Current.m_Name, sizeof(m_Current.m_Name)) == 0)
+    {
+        key = m_Current;
+        return 1;
+    }
+
+    /* Tickets issued with the previous key are accepted for one more
+       lifetime. */
+    if (m_HasPrevious &&
+        memcmp(name, m_Previous.m_Name, sizeof(m_Previous.m_Name)) == 0 &&
+        std::chrono::steady_clock::now() - m_Previous.m_Created < 2 * m_Lifetime)
+    {
+        key = m_Previous;
+        return 2;
+    }
+
+    return 0;
+}
+
+void SslContext::ConfigureSessions(const SslSessionOptions& options)
+{
+    SSL_CTX_set_app_data(m_Ctx, this);
+
+    if (SSL_CTX_set_session_id_context(m_Ctx, SessionIdContext, sizeof(SessionIdContext) - 1) <= 0)
+    {
+        throw std::runtime_error("Unable to set the session id context");
+    }
+
+    if (options.m_SessionCache)
+    {
+        m_SessionCache = std::make_unique<SslSessionCache>(options.m_SessionCacheSize,
+                                                           options.m_SessionCacheShards);
+
+        SSL_CTX_set_session_cache_mode(m_Ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+        SSL_CTX_set_timeout(m_Ctx, (long)options.m_SessionTimeout.count());
+        SSL_CTX_sess_set_new_cb(m_Ctx, NewSessionCallback);
+        SSL_CTX_sess_set_get_cb(m_Ctx, GetSessionCallback);
+        SSL_CTX_sess_set_remove_cb(m_Ctx, RemoveSessionCallback);
+    }
+    else
+    {
+        SSL_CTX_set_session_cache_mode(m_Ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if (!options.m_SessionTickets)
+    {
+        SSL_CTX_set_options(m_Ctx, SSL_OP_NO_TICKET);
+        return;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    m_TicketKeys = std::make_unique<SslTicketKeys>(options.m_TicketKeyLifetime, m_Statistics);
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(m_Ctx, TicketKeyCallback);
+#endif
+    /* Older OpenSSL versions keep their own, non-rotating ticket keys. */
+}
+
+void SslContext::ConfigureMemory(const SslMemoryOptions& options)
+{
+    if (options.m_ReleaseBuffers)
+    {
+        SSL_CTX_set_mode(m_Ctx, SSL_MODE_RELEASE_BUFFERS);
+    }
+    else
+    {
+        SSL_CTX_clear_mode(m_Ctx, SSL_MODE_RELEASE_BUFFERS);
+    }
+
+    if (options.m_MaxSendFragment != 0 &&
+        SSL_CTX_set_max_send_fragment(m_Ctx, (long)options.m_MaxSendFragment) <= 0)
+    {
+        throw std::runtime_error("Invalid maximum send fragment size");
+    }
+
+    if (options.m_ReadBufferLength != 0)
+    {
+        SSL_CTX_set_default_read_buffer_len(m_Ctx, options.m_ReadBufferLength);
+    }
+}
+
+bool SslContext::InstallAllocator()
+{
+    if (OpenSslAllocatorInstalled)
+    {
+        return true;
+    }
+
+    if (CRYPTO_set_mem_functions(PooledMalloc, PooledRealloc, PooledFree) == 0)
+    {
+        return false;
+    }
+
+    OpenSslAllocatorInstalled = true;
+    return true;
+}
+
+int64_t SslContext::GetMemoryUsage()
+{
+    return OpenSslAllocatorInstalled ? OpenSslMemory.load() : -1;
+}
+
+int64_t SslContext::GetPooledMemory()
+{
+    return OpenSslAllocatorInstalled ? RecordBufferPool::PooledMemory.load() : -1;
+}
+
+int64_t SslContext::GetMemoryPerConnection() const
+{
+    int64_t connections = m_Statistics.m_ActiveConnections;
+    if (!OpenSslAllocatorInstalled || connections <= 0)
+    {
+        return -1;
+    }
+
+    return OpenSslMemory / connections;
+}
+
+bool SslReplayWindow::Admit(const std::string& clientRandom)
+{
+    std::lock_guard guard(m_Mutex);
+
+    auto now = std::chrono::steady_clock::now();
+    while (!m_Order.empty() && now - m_Order.front().first > m_Window)
+    {
+        m_Seen.erase(m_Order.front().second);
+        m_Order.pop_front();
+    }
+
+    if (m_Seen.size() >= m_Capacity || m_Seen.contains(clientRandom))
+    {
+        return false;
+    }
+
+    m_Seen.insert(clientRandom);
+    m_Order.push_back(std::make_pair(now, clientRandom));
+    return true;
+}
+
+void SslContext::EnableEarlyData(uint32_t maxEarlyData,
+                                 std::chrono::seconds replayWindow,
+                                 size_t replayCapacity)
+{
+    m_ReplayWindow = std::make_unique<SslReplayWindow>(replayWindow, replayCapacity);
+
+    if (SSL_CTX_set_max_early_data(m_Ctx, maxEarlyData) <= 0 ||
+        SSL_CTX_set_recv_max_early_data(m_Ctx, maxEarlyData) <= 0)
+    {
+        throw std::runtime_error("Unable to enable early data");
+    }
+
+    /* OpenSSL's own protection makes every ticket single use, the replay
+       window allows tickets to be reused and still refuses replayed early
+       data. */
+    SSL_CTX_set_options(m_Ctx, SSL_OP_NO_ANTI_REPLAY);
+    SSL_CTX_set_allow_early_data_cb(m_Ctx, AllowEarlyDataCallback, this);
+}
+
+int SslContext::AllowEarlyDataCallback(SSL* ssl, void* arg)
+{
+    SslContext* context = (SslContext*)arg;
+
+    unsigned char clientRandom[SSL3_RANDOM_SIZE];
+    size_t length = SSL_get_client_random(ssl, clientRandom, sizeof(clientRandom));
+
+    if (!context->m_ReplayWindow->Admit(std::string((const char*)clientRandom, length)))
+    {
+        context->m_Statistics.m_EarlyDataReplaysRejected++;
+        return 0;
+    }
+
+    context->m_Statistics.m_EarlyDataAccepted++;
+    return 1;
+}
+
+bool SslContext::EnableKernelTls()
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL_CTX_set_options(m_Ctx, SSL_OP_ENABLE_KTLS);
+    return true;
+#else
+    return false;
+#endif
+}
+
+SslContext* SslContext::FromSsl(SSL* ssl)
+{
+    return (SslContext*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+}
+
+int SslContext::NewSessionCallback(SSL* ssl, SSL_SESSION* session)
+{
+    SslContext* context = FromSsl(ssl);
+
+    unsigned int idLength;
+    const unsigned char* id = SSL_SESSION_get_id(session, &idLength);
+
+    int size = i2d_SSL_SESSION(session, nullptr);
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+    std::vector<unsigned char> data(size);
+    unsigned char* dataPtr = data.data();
+    i2d_SSL_SESSION(session, &dataPtr);
+
+    context->m_SessionCache->Add(std::string((const char*)id, idLength),
+                                 std::move(data),
+                                 std::chrono::seconds(SSL_SESSION_get_timeout(session)));
+
+    /* The session is stored serialized, OpenSSL keeps its reference. */
+    return 0;
+}
+
+SSL_SESSION* SslContext::GetSessionCallback(SSL* ssl, const unsigned char* id, int idLength, int* copy)
+{
+    SslContext* context = FromSsl(ssl);
+    std::vector<unsigned char> data;
+
+    *copy = 0;
+
+    if (!context->m_SessionCache->Find(std::string((const char*)id, idLength), data))
+    {
+        context->m_Statistics.m_SessionCacheMisses++;
+        return nullptr;
+    }
+
+    context->m_Statistics.m_SessionCacheHits++;
+
+    const unsigned char* dataPtr = data.data();
+    return d2i_SSL_SESSION(nullptr, &dataPtr, (long)data.size());
+}
+
+void SslContext::RemoveSessionCallback(SSL_CTX* ctx, SSL_SESSION* session)
+{
+    SslContext* context = (SslContext*)SSL_CTX_get_app_data(ctx);
+
+    unsigned int idLength;
+    const unsigned char* id = SSL_SESSION_get_id(session, &idLength);
+
+    context->m_SessionCache->Remove(std::string((const char*)id, idLength));
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int SslContext::TicketKeyCallback(SSL* ssl,
+                                  unsigned char* keyName,
+                                  unsigned char* iv,
+                                  EVP_CIPHER_CTX* cipherCtx,
+                                  EVP_MAC_CTX* macCtx,
+                                  int encrypt)
+{
+    SslContext* context = FromSsl(ssl);
+    SslTicketKeys::Key key;
+    int result = 1;
+
+    if (encrypt)
+    {
+        key = context->m_TicketKeys->GetCurrent();
+        memcpy(keyName, key.m_Name, sizeof(key.m_Name));
+
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0 ||
+            EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.m_AesKey, iv) <= 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        result = context->m_TicketKeys->Find(keyName, key);
+        if (result == 0)
+        {
+            return 0;
+        }
+
+        /* TLS 1.3 clients use a ticket only once, and a resumed connection
+           only gets a new one if the ticket is renewed. */
+        if (SSL_version(ssl) >= TLS1_3_VERSION)
+        {
+            result = 2;
+        }
+
+        if (EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.m_AesKey, iv) <= 0)
+        {
+            return -1;
+        }
+    }
+
+    OSSL_PARAM params[] =
+    {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.m_HmacKey, sizeof(key.m_HmacKey)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0),
+        OSSL_PARAM_construct_end()
+    };
+
+    if (EVP_MAC_CTX_set_params(macCtx, params) <= 0)
+    {
+        return -1;
+    }
+
+    return result;
+}
+#endif
+
+void SslConnection::WaitHandshake(InetSocketWrapper::InetSocket& clientSocket,
+                                  int error,
+                                  std::chrono::steady_clock::time_point deadline)
+{
+    SslStatistics& statistics = m_Context.m_Statistics;
+
+    if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+    {
+        m_Bad = true;
+        statistics.m_FailedHandshakes++;
+        throw std::runtime_error("Couldn't accept SSL connection");
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+
+    if (remaining.count() <= 0 ||
+        !clientSocket.WaitReady(error == SSL_ERROR_WANT_WRITE, (int)remaining.count()))
+    {
+        m_Bad = true;
+        statistics.m_HandshakeTimeouts++;
+        throw std::runtime_error("SSL handshake timed out");
+    }
+}
+
+/* Only complete requests without a body, with methods that are safe to
+   replay. */
+static bool IsEarlyRequestSafe(const std::string& data)
+{
+    auto headersEnd = data.find("\r\n\r\n");
+    if (headersEnd == std::string::npos || headersEnd + 4 != data.size())
+    {
+        return false;
+    }
+
+    std::string method = data.substr(0, data.find(' '));
+    std::transform(method.begin(), method.end(), method.begin(), ::toupper);
+
+    return method == "GET" || method == "HEAD";
+}
+
+bool SslConnection::ReadEarlyData(InetSocketWrapper::InetSocket& clientSocket,
+                                  std::chrono::steady_clock::time_point deadline)
+{
+    char buffer[4096];
+
+    while (true)
+    {
+        size_t readBytes = 0;
+        int result = SSL_read_early_data(m_Ssl, buffer, sizeof(buffer), &readBytes);
+
+        if (result == SSL_READ_EARLY_DATA_SUCCESS)
+        {
+            m_EarlyData.append(buffer, readBytes);
+
+            /* The end of early data only arrives after a round trip, which
+               is what answering early is meant to save. */
+            if (IsEarlyRequestSafe(m_EarlyData))
+            {
+                return true;
+            }
+            continue;
+        }
+
+        if (result == SSL_READ_EARLY_DATA_FINISH)
+        {
+            return false;
+        }
+
+        WaitHandshake(clientSocket, SSL_get_error(m_Ssl, result), deadline);
+    }
+}
+
+void SslConnection::FinishHandshake()
+{
+    m_HandshakePending = false;
+
+    char buffer[4096];
+    while (true)
+    {
+        size_t readBytes = 0;
+        int result = SSL_read_early_data(m_Ssl, buffer, sizeof(buffer), &readBytes);
+
+        if (result == SSL_READ_EARLY_DATA_SUCCESS)
+        {
+            m_EarlyData.append(buffer, readBytes);
+            continue;
+        }
+
+        if (result == SSL_READ_EARLY_DATA_ERROR || SSL_do_handshake(m_Ssl) <= 0)
+        {
+            m_Bad = true;
+        }
+        return;
+    }
+}
+
+void SslConnection::Accept(InetSocketWrapper::InetSocket& clientSocket)
+{
+    SslStatistics& statistics = m_Context.m_Statistics;
+
+    struct InFlightCounter
+    {
+        std::atomic<int64_t>& m_Counter;
+
+        InFlightCounter(std::atomic<int64_t>& counter) : m_Counter(counter)
+        {
+            m_Counter++;
+        }
+
+        ~InFlightCounter()
+        {
+            m_Counter--;
+        }
+    } inFlight(statistics.m_HandshakesInFlight);
+
+    auto deadline = std::chrono::steady_clock::now() + m_Context.m_HandshakeTimeout;
+
+    clientSocket.SetBlocking(false);
+
+    if (m_Context.m_ReplayWindow != nullptr)
+    {
+        if (ReadEarlyData(clientSocket, deadline))
+        {
+            statistics.m_EarlyRequestsServed++;
+            statistics.m_ResumedHandshakes++;
+
+            m_HandshakePending = true;
+            clientSocket.SetBlocking(true);
+            return;
+        }
+
+        /* Anything else is processed once the handshake is complete. */
+        if (!m_EarlyData.empty())
+        {
+            statistics.m_EarlyRequestsDeferred++;
+        }
+    }
+
+    while (true)
+    {
+        int result = SSL_accept(m_Ssl);
+        if (result > 0)
+        {
+            break;
+        }
+
+        WaitHandshake(clientSocket, SSL_get_error(m_Ssl, result), deadline);
+    }
+
+    /* The rest of the connection uses blocking I/O. */
+    clientSocket.SetBlocking(true);
+
+    if (IsKernelTlsSend())
+    {
+        statistics.m_KernelTlsConnections++;
+    }
+
+    if (SSL_session_reused(m_Ssl))
+    {
+        statistics.m_ResumedHandshakes++;
+    }
+    else
+    {
+        statistics.m_FullHandshakes++;
+    }
+}
+
+void SslConnection::Write(std::string_view str)
+{
+    if (m_HandshakePending)
+    {
+        size_t written = 0;
+
+        if (SSL_write_early_data(m_Ssl, str.data(), str.length(), &written) <= 0)
+        {
+            m_Bad = true;
+        }
+        return;
+    }
+
+    auto curSize = SSL_write(m_Ssl, str.data(), str.length());
+    if (curSize <= 0)
+    {
+        m_Bad = true;
+    }
+}
+
+bool SslConnection::IsKernelTlsSend() const
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    return BIO_get_ktls_send(SSL_get_wbio(m_Ssl)) > 0;
+#else
+    return false;
+#endif
+}
+
+size_t SslConnection::SendFile(int fd, size_t offset, size_t size)
+{
+    size_t sent = 0;
+
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    if (!IsKernelTlsSend())
+    {
+        return 0;
+    }
+
+    while (sent < size)
+    {
+        auto result = SSL_sendfile(m_Ssl, fd, (off_t)(offset + sent), size - sent, 0);
+        if (result <= 0)
+        {
+            break;
+        }
+
+        sent += result;
+    }
+#endif
+
+    return sent;
+}
+
+std::string SslConnection::Read(size_t maxSize)
+{
+    if (m_HandshakePending && m_EarlyData.empty())
+    {
+        FinishHandshake();
+    }
+
+    if (!m_EarlyData.empty())
+    {
+        return std::exchange(m_EarlyData, std::string());
+    }
+
+    maxSize = std::min(maxSize, ReadBufferSize);
+
+    auto curSize = SSL_read(m_Ssl, ReadBuffer, (int)maxSize);
+    if (curSize <= 0)
+    {
+        m_Bad = true;
+        return "";
+    }
+
+    return std::string(ReadBuffer, ReadBuffer + curSize);
+}
@@ -5,13 +5,166 @@
 #include <openssl/ssl.h>
 #include "InetSocketWrapper.h"
 #include <stdexcept>
+#include <string_view>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
 
 struct SslContext;
 struct SslConnection;
 
+struct SslSessionOptions
+{
+    /* Server-side cache, used for TLS 1.2 session IDs and, when tickets are
+       disabled, for TLS 1.3 stateful tickets. */
+    bool m_SessionCache = true;
+    size_t m_SessionCacheSize = 20480;
+    size_t m_SessionCacheShards = 16;
+    std::chrono::seconds m_SessionTimeout = std::chrono::hours(1);
+
+    /* Stateless tickets, encrypted with keys that only live in memory. */
+    bool m_SessionTickets = true;
+    std::chrono::seconds m_TicketKeyLifetime = std::chrono::hours(12);
+};
+
+/* Settings that trade a bit of CPU for less memory per connection, useful
+   with many idle connections. */
+struct SslMemoryOptions
+{
+    /* Free the read and write buffers while a connection is idle. They are
+       kept for other connections if SslContext::InstallAllocator was used. */
+    bool m_ReleaseBuffers = true;
+
+    /* Maximum plaintext per record, 0 keeps the OpenSSL default (16 kB). */
+    size_t m_MaxSendFragment = 4096;
+
+    /* Initial read buffer size, 0 keeps the OpenSSL default. */
+    size_t m_ReadBufferLength = 0;
+};
+
+struct SslStatistics
+{
+    std::atomic<int64_t> m_ActiveConnections = 0;
+    std::atomic<uint64_t> m_FullHandshakes = 0;
+    std::atomic<uint64_t> m_ResumedHandshakes = 0;
+    std::atomic<uint64_t> m_FailedHandshakes = 0;
+    std::atomic<uint64_t> m_HandshakeTimeouts = 0;
+    std::atomic<int64_t> m_HandshakesInFlight = 0;
+    std::atomic<uint64_t> m_SessionCacheHits = 0;
+    std::atomic<uint64_t> m_SessionCacheMisses = 0;
+    std::atomic<uint64_t> m_TicketKeyRotations = 0;
+    std::atomic<uint64_t> m_KernelTlsConnections = 0;
+    std::atomic<uint64_t> m_EarlyDataAccepted = 0;
+    std::atomic<uint64_t> m_EarlyDataReplaysRejected = 0;
+    std::atomic<uint64_t> m_EarlyRequestsServed = 0;
+    std::atomic<uint64_t> m_EarlyRequestsDeferred = 0;
+};
+
+/* Serialized sessions split over independently locked shards, so that
+   concurrent handshakes rarely contend on the same mutex. */
+class SslSessionCache
+{
+private:
+    struct Entry
+    {
+        std::vector<unsigned char> m_Data;
+        std::chrono::steady_clock::time_point m_Expiration;
+        uint64_t m_Sequence;
+    };
+
+    struct Shard
+    {
+        std::mutex m_Mutex;
+        std::unordered_map<std::string, Entry> m_Sessions;
+        /* Insertion order, for evicting the oldest sessions. */
+        std::deque<std::pair<std::string, uint64_t>> m_Order;
+        uint64_t m_Sequence = 0;
+    };
+
+    std::vector<std::unique_ptr<Shard>> m_Shards;
+    size_t m_ShardCapacity;
+
+    Shard& GetShard(const std::string& id);
+
+public:
+    SslSessionCache(size_t capacity, size_t shards);
+
+    void Add(const std::string& id,
+             std::vector<unsigned char>&& data,
+             std::chrono::steady_clock::duration timeout);
+
+    bool Find(const std::string& id, std::vector<unsigned char>& data);
+
+    void Remove(const std::string& id);
+};
+
+/* Remembers the ClientHello randoms that carried early data within the last
+   window. A replayed ClientHello has the same random, so its early data is
+   refused and the client falls back to a full round trip. OpenSSL refuses
+   early data from tickets whose age is off by more than 10 seconds, so the
+   window has to be longer than that. */
+class SslReplayWindow
+{
+private:
+    std::mutex m_Mutex;
+    std::unordered_set<std::string> m_Seen;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> m_Order;
+    std::chrono::seconds m_Window;
+    size_t m_Capacity;
+
+public:
+    SslReplayWindow(std::chrono::seconds window, size_t capacity) :
+        m_Window(window), m_Capacity(capacity)
+    {
+    }
+
+    /* Returns false for a replay, or if the window is full and replays
+       couldn't be detected. */
+    bool Admit(const std::string& clientRandom);
+};
+
+/* Session ticket keys. A new key is generated every lifetime, the previous
+   one is kept to decrypt tickets issued before the rotation. */
+class SslTicketKeys
+{
+public:
+    struct Key
+    {
+        unsigned char m_Name[16];
+        unsigned char m_AesKey[32];
+        unsigned char m_HmacKey[32];
+        std::chrono::steady_clock::time_point m_Created;
+    };
+
+    SslTicketKeys(std::chrono::seconds lifetime, SslStatistics& statistics);
+
+    Key GetCurrent();
+
+    /* Returns 0 if no key matches, 1 for the current key and 2 for the
+       previous one, in which case the ticket should be renewed. */
+    int Find(const unsigned char* name, Key& key);
+
+private:
+    std::shared_mutex m_Mutex;
+    std::chrono::seconds m_Lifetime;
+    SslStatistics& m_Statistics;
+    Key m_Current;
+    Key m_Previous;
+    bool m_HasPrevious = false;
+
+    static Key Generate();
+};
+
 struct SslContext
 {
-    SslContext(const std::string& certFile, const std::string& keyFile)
+    SslContext(const std::string& certFile, 
+               const std::string& keyFile,
+               const SslSessionOptions& sessionOptions = SslSessionOptions())
     {
         m_Ctx = SSL_CTX_new(TLS_server_method());
         if (!m_Ctx)
@@ -28,8 +181,13 @@ struct SslContext
         {
             throw std::runtime_error("Unable to use the private key file");
         }
+
+        ConfigureSessions(sessionOptions);
     }
 
+    SslContext(const SslContext&) = delete;
+    SslContext& operator=(const SslContext&) = delete;
+
     ~SslContext()
     {
         if (m_Ctx != nullptr)
@@ -39,16 +197,79 @@ struct SslContext
         }
     }
 
+    const SslStatistics& GetStatistics() const
+    {
+        return m_Statistics;
+    }
+
+    /* Lets the kernel encrypt records (kTLS), which allows SSL_sendfile.
+       Returns false if this OpenSSL build can't do it. Connections still fall
+       back to user-space encryption when the kernel or cipher doesn't support
+       it. */
+    bool EnableKernelTls();
+
+    void ConfigureMemory(const SslMemoryOptions& options);
+
+    /* Replaces the allocator of OpenSSL, for all contexts, with one that
+       counts its memory and keeps the record buffers that connections release
+       while idle in a pool shared by all of them. Has to be called before
+       anything else uses OpenSSL, returns false otherwise. */
+    static bool InstallAllocator();
+
+    /* Bytes currently used by OpenSSL, if the allocator is installed. */
+    static int64_t GetMemoryUsage();
+
+    /* Bytes of released record buffers kept for reuse, if the allocator is
+       installed. */
+    static int64_t GetPooledMemory();
+
+    /* Average OpenSSL memory per active connection of this context, if the
+       allocator is installed. Includes the memory shared by all connections,
+       but not the pooled buffers. */
+    int64_t GetMemoryPerConnection() const;
+
+    /* Accepts TLS 1.3 early data on resumed sessions. GET and HEAD requests
+       that arrive completely in it are processed before the handshake
+       finishes, anything else waits for the handshake as usual. */
+    void EnableEarlyData(uint32_t maxEarlyData = 16384,
+                         std::chrono::seconds replayWindow = std::chrono::seconds(30),
+                         size_t replayCapacity = 65536);
+
+    /* Clients that don't finish the handshake within it are dropped. */
+    std::chrono::milliseconds m_HandshakeTimeout = std::chrono::seconds(10);
+
 private:
     SSL_CTX* m_Ctx;
+    mutable SslStatistics m_Statistics;
+    std::unique_ptr<SslSessionCache> m_SessionCache;
+    std::unique_ptr<SslTicketKeys> m_TicketKeys;
+    std::unique_ptr<SslReplayWindow> m_ReplayWindow;
+
+    void ConfigureSessions(const SslSessionOptions& options);
+
+    static SslContext* FromSsl(SSL* ssl);
+    static int NewSessionCallback(SSL* ssl, SSL_SESSION* session);
+    static SSL_SESSION* GetSessionCallback(SSL* ssl, const unsigned char* id, int idLength, int* copy);
+    static void RemoveSessionCallback(SSL_CTX* ctx, SSL_SESSION* session);
+    static int AllowEarlyDataCallback(SSL* ssl, void* arg);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int TicketKeyCallback(SSL* ssl,
+                                 unsigned char* keyName,
+                                 unsigned char* iv,
+                                 EVP_CIPHER_CTX* cipherCtx,
+                                 EVP_MAC_CTX* macCtx,
+                                 int encrypt);
+#endif
 
     friend struct SslConnection;
 };
 
 struct SslConnection
 {
+    /* The handshake is not performed here, see Accept. */
     SslConnection(const SslContext& context, 
-                  InetSocketWrapper::InetSocket& clientSocket)
+                  InetSocketWrapper::InetSocket& clientSocket) :
+        m_Context(context)
     {
         m_Ssl = SSL_new(context.m_Ctx);
 
@@ -59,53 +280,78 @@ struct SslConnection
 
         if (SSL_set_fd(m_Ssl, clientSocket.GetNativeDescriptor()) <= 0)
         {
+            SSL_free(m_Ssl);
             throw std::runtime_error("Couldn't set file descriptor for SSL connection");
         }
 
-        if (SSL_accept(m_Ssl) <= 0)
-        {
-            throw std::runtime_error("Couldn't accept SSL connection");
-        }
+        m_Context.m_Statistics.m_ActiveConnections++;
     }
 
+    SslConnection(const SslConnection&) = delete;
+    SslConnection& operator=(const SslConnection&) = delete;
+
     ~SslConnection()
     {
         if (m_Ssl != nullptr)
         {
-            SSL_shutdown(m_Ssl);
+            /* A request answered from early data leaves the rest of the
+               handshake to be done. */
+            if (m_HandshakePending && !m_Bad)
+            {
+                FinishHandshake();
+            }
+
+            if (SSL_is_init_finished(m_Ssl))
+            {
+                SSL_shutdown(m_Ssl);
+            }
             SSL_free(m_Ssl);
             m_Ssl = nullptr;
-        }
-    }
 
-    void Write(const std::string& str)
-    {
-        auto curSize = SSL_write(m_Ssl, str.c_str(), str.length());
-        if (curSize <= 0)
-        {
-            m_Bad = true;
+            m_Context.m_Statistics.m_ActiveConnections--;
         }
     }
 
-    std::string Read(size_t maxSize = 8192)
-    {
-        std::unique_ptr<char[]> buffer = std::make_unique<char[]>(maxSize);
+    /* Performs the handshake without blocking on any single read or write,
+       so a client that stalls can be dropped after the context's handshake
+       timeout. */
+    void Accept(InetSocketWrapper::InetSocket& clientSocket);
 
-        auto curSize = SSL_read(m_Ssl, buffer.get(), maxSize);
-        if (curSize <= 0)
-        {
-            m_Bad = true;
-            return "";
-        }
+    /* True if records sent on this connection are encrypted by the kernel. */
+    bool IsKernelTlsSend() const;
 
-        return std::string(buffer.get(), buffer.get() + curSize);
-    }
+    /* Sends a part of a file without copying it to user space. Only possible
+       with kernel TLS, returns the number of bytes sent, which is less than
+       size if it is unavailable or fails. */
+    size_t SendFile(int fd, size_t offset, size_t size);
+
+    void Write(std::string_view str);
+
+    std::string Read(size_t maxSize = 8192);
 
     bool Bad()
     {
         return m_Bad;
     }
 private:
+    const SslContext& m_Context;
     SSL* m_Ssl;
     bool m_Bad = false;
+
+    /* Set while a request received as early data is answered before the
+       handshake is complete. */
+    bool m_HandshakePending = false;
+    std::string m_EarlyData;
+
+    void WaitHandshake(InetSocketWrapper::InetSocket& clientSocket,
+                       int error,
+                       std::chrono::steady_clock::time_point deadline);
+
+    /* Returns true as soon as the early data holds a request that can be
+       answered before the handshake completes. */
+    bool ReadEarlyData(InetSocketWrapper::InetSocket& clientSocket,
+                       std::chrono::steady_clock::time_point deadline);
+
+    /* Reads what is left of the early data and completes the handshake. */
+    void FinishHandshake();
 };
\ No newline at end of file
@@ -4,6 +4,31 @@
 
 void IndexPage::GenerateContent(const Request& request, Tag* contentContainer)
 {
+    auto greeting = GenerateHole("greeting", request);
+    if (greeting != nullptr)
+    {
+        contentContainer->AddTag(std::move(greeting));
+    }
+
+    GenerateNavigation(contentContainer);
+}
+
+void IndexPage::GenerateSkeletonContent(Tag* body)
+{
+    auto contentContainer = body->Div();
+
+    /* Only the greeting depends on the request. */
+    contentContainer->Hole("greeting");
+    GenerateNavigation(contentContainer);
+}
+
+std::unique_ptr<Tag> IndexPage::GenerateHole(const std::string& hole, const Request& request)
+{
+    if (hole != "greeting")
+    {
+        return Page::GenerateHole(hole, request);
+    }
+
     SessionHandle session;
 
     auto cookies = request.GetCookies();
@@ -12,11 +37,18 @@ void IndexPage::GenerateContent(const Request& request, Tag* contentContainer)
         session = SessionHandle(cookies.at("sessionId"));
     }
 
-    if (session)
+    if (!session)
     {
-        contentContainer->Text("Hello, " + session.ReadProperty("username"));
+        return nullptr;
     }
 
+    auto greeting = std::make_unique<Tag>(TagName("text"));
+    greeting->AddContent("Hello, " + session.ReadProperty("username"));
+    return greeting;
+}
+
+void IndexPage::GenerateNavigation(Tag* contentContainer)
+{
     auto pages = contentContainer->P("Pages:<br>");
     auto p = GetNavbar();
 
@@ -36,4 +68,4 @@ std::list<std::pair<std::string, std::string>> IndexPage::GetNavbar() const
     {
         {"Main page", "/"}
     };
-}
\ No newline at end of file
+}
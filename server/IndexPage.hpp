@@ -7,5 +7,9 @@ struct IndexPage : public Page
     virtual ~IndexPage() = default;
 
     void GenerateContent(const Request& request, Tag* contentContainer) override;
+    void GenerateSkeletonContent(Tag* body) override;
+    std::unique_ptr<Tag> GenerateHole(const std::string& hole, const Request& request) override;
     std::list<std::pair<std::string, std::string>> GetNavbar() const;
+private:
+    void GenerateNavigation(Tag* contentContainer);
 };
@@ -73,6 +73,8 @@ std::mutex InetSocketWrapper::InetSocket::WsaReference::WsaMutex = std::mutex();
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
 
 static std::string GetLastStringError()
 {
@@ -580,6 +582,49 @@ namespace InetSocketWrapper
         return std::string((char*) buf);
     }
 
+    void InetSocket::SetBlocking(bool blocking)
+    {
+#ifdef _WIN32
+        u_long mode = blocking ? 0 : 1;
+        if (ioctlsocket(this->sockfd, FIONBIO, &mode) != 0)
+        {
+            throw std::runtime_error("ioctlsocket: " + GetLastStringError());
+        }
+#else
+        int flags = fcntl(this->sockfd, F_GETFL, 0);
+        if (flags < 0)
+        {
+            throw std::runtime_error("fcntl: " + GetLastStringError());
+        }
+
+        flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+        if (fcntl(this->sockfd, F_SETFL, flags) < 0)
+        {
+            throw std::runtime_error("fcntl: " + GetLastStringError());
+        }
+#endif
+    }
+
+    bool InetSocket::WaitReady(bool forWriting, int timeoutMs)
+    {
+        pollfd pfd;
+        pfd.fd = this->sockfd;
+        pfd.events = forWriting ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+
+#ifdef _WIN32
+        int result = WSAPoll(&pfd, 1, timeoutMs);
+#else
+        int result = poll(&pfd, 1, timeoutMs);
+#endif
+        if (result < 0)
+        {
+            throw std::runtime_error("poll: " + GetLastStringError());
+        }
+
+        return result > 0;
+    }
+
     bool InetSocket::Bad()
     {
         return !IsFdValid(this->sockfd);
@@ -206,6 +206,12 @@ namespace InetSocketWrapper
         void DisableNagle();
 
 
+        void SetBlocking(bool blocking);
+
+
+        bool WaitReady(bool forWriting, int timeoutMs);
+
+
         auto GetNativeDescriptor() noexcept
         {
             return this->sockfd;
@@ -1,9 +1,9 @@
 #pragma once
 
 #include "Http.hpp"
-#include "TimedEvent.hpp"
+#include "SessionBackend.hpp"
 
-struct LoginSession;
+#include <memory>
 
 struct SessionHandle
 {
@@ -15,7 +15,8 @@ struct SessionHandle
     operator bool() const;
     bool operator!() const;
 private:
-    LoginSession* m_Session = nullptr;
+    /* Keeps the session alive even if it expires while being used. */
+    std::shared_ptr<Session> m_Session;
 };
 
 struct LoginApi
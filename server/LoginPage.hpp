@@ -6,4 +6,9 @@ struct LoginPage : public Page
 {
     void GenerateContent(const Request& request, Tag* contentContainer);
     std::string GetTitle() const;
+
+    bool IsStatic() const
+    {
+        return true;
+    }
 };
\ No newline at end of file
@@ -7,7 +7,7 @@
 
 Page::MainContent::operator std::unique_ptr<Tag>()
 {
-    auto contentContainer = std::make_unique<Tag>("div");
+    auto contentContainer = std::make_unique<Tag>(TagName("div"));
 
     if (m_GenerateContent != nullptr)
     {
@@ -17,9 +17,13 @@ Page::MainContent::operator std::unique_ptr<Tag>()
     return contentContainer;
 }
 
-HttpResponse Page::operator()(const Request& request)
+std::shared_ptr<const HtmlTemplate> Page::GetSkeleton()
 {
-    std::string content = "";
+    auto skeleton = m_SkeletonCache.m_Skeleton.load();
+    if (skeleton != nullptr)
+    {
+        return skeleton;
+    }
 
     auto html = Tag::Html();
     auto head = html->Head();
@@ -31,18 +35,49 @@ HttpResponse Page::operator()(const Request& request)
     metaViewport->AddProperty("name", "viewport");
     metaViewport->AddProperty("content", "width=device-width, initial-scale=1.0");
 
-    auto body = html->Body();
+    GenerateSkeletonContent(html->Body());
+
+    /* Concurrent first requests may both compile it, either result is fine. */
+    skeleton = std::make_shared<const HtmlTemplate>(*html);
+    m_SkeletonCache.m_Skeleton.store(skeleton);
+
+    return skeleton;
+}
 
-    auto mainContent =
-        body->AddTag(
-            MainContent(
-                GetTitle(),
-                [&](Tag* contentContainer)
-                {
-                    this->GenerateContent(request, contentContainer);
-                }));
+HttpResponse Page::operator()(const Request& request)
+{
+    auto skeleton = GetSkeleton();
+
+    std::vector<std::unique_ptr<Tag>> fills;
+    for (const auto& hole : skeleton->GetHoles())
+    {
+        fills.push_back(GenerateHole(hole, request));
+    }
 
-    return HttpResponse(html->Emit(), GetStatus(), "text/html");
+    return HttpResponse(
+        std::make_unique<TemplateContentPromise>(skeleton, std::move(fills)),
+        GetStatus(),
+        "text/html");
+}
+
+void Page::GenerateSkeletonContent(Tag* body)
+{
+    body->Hole("content");
+}
+
+std::unique_ptr<Tag> Page::GenerateHole(const std::string& hole, const Request& request)
+{
+    if (hole != "content")
+    {
+        return nullptr;
+    }
+
+    return MainContent(
+        GetTitle(),
+        [&](Tag* contentContainer)
+        {
+            this->GenerateContent(request, contentContainer);
+        });
 }
 
 std::string Page::GetTitle() const
@@ -53,4 +88,4 @@ std::string Page::GetTitle() const
 int Page::GetStatus()
 {
     return 200;
-}
\ No newline at end of file
+}
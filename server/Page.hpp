@@ -2,9 +2,52 @@
 
 #include "Http.hpp"
 #include "Html.hpp"
+#include "HtmlTemplate.hpp"
 
+#include <atomic>
 #include <functional>
 
+/* Gathers the segments of a precompiled template with the subtrees generated
+   for its holes. */
+class TemplateContentPromise : public ContentPromise
+{
+    std::shared_ptr<const HtmlTemplate> m_Template;
+    std::vector<std::unique_ptr<Tag>> m_Fills;
+
+    void Render(HtmlWriter& writer)
+    {
+        m_Template->Render(writer,
+            [&](size_t holeIndex, HtmlWriter& writer)
+            {
+                if (m_Fills[holeIndex] != nullptr)
+                {
+                    m_Fills[holeIndex]->Write(writer);
+                }
+            });
+    }
+
+public:
+    TemplateContentPromise(const std::shared_ptr<const HtmlTemplate>& htmlTemplate,
+                           std::vector<std::unique_ptr<Tag>>&& fills) :
+        m_Template(htmlTemplate), m_Fills(std::move(fills))
+    {
+    }
+
+    std::string Fulfill() override
+    {
+        HtmlWriter writer(m_Template->GetStaticSize() * 2);
+        Render(writer);
+        return writer.Take();
+    }
+
+    void Stream(const ContentSink& sink) override
+    {
+        HtmlWriter writer(sink);
+        Render(writer);
+        writer.Flush();
+    }
+};
+
 struct Page
 {
     virtual ~Page() = default;
@@ -28,4 +71,33 @@ struct Page
     virtual void GenerateContent(const Request& request, Tag* contentContainer) = 0;
     virtual std::string GetTitle() const;
     virtual int GetStatus();
-};
\ No newline at end of file
+
+    /* Builds the request-independent part of the body. Parts that depend on
+       the request are left as Tag::Hole and generated by GenerateHole. */
+    virtual void GenerateSkeletonContent(Tag* body);
+    virtual std::unique_ptr<Tag> GenerateHole(const std::string& hole, const Request& request);
+
+    std::shared_ptr<const HtmlTemplate> GetSkeleton();
+
+private:
+    /* Pages are copied into Responders, so the cache has to be copyable. */
+    struct SkeletonCache
+    {
+        std::atomic<std::shared_ptr<const HtmlTemplate>> m_Skeleton;
+
+        SkeletonCache() = default;
+
+        SkeletonCache(const SkeletonCache& other) :
+            m_Skeleton(other.m_Skeleton.load())
+        {
+        }
+
+        SkeletonCache& operator=(const SkeletonCache& other)
+        {
+            m_Skeleton.store(other.m_Skeleton.load());
+            return *this;
+        }
+    };
+
+    SkeletonCache m_SkeletonCache;
+};
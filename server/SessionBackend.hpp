@@ -0,0 +1,36 @@
+#pragma once
+
+#include <map>
+#include <chrono>
+#include <memory>
+#include <string>
+
+/* Properties of one session, as seen by a single request. */
+struct Session
+{
+    virtual ~Session() = default;
+
+    virtual std::string ReadProperty(const std::string& key) = 0;
+    virtual std::string WriteProperty(const std::string& key, const std::string& value) = 0;
+};
+
+/* Where sessions are kept. Selected once at startup, before the services
+   begin accepting, the default is the in-process SessionStore. */
+class SessionBackend
+{
+public:
+    virtual ~SessionBackend() = default;
+
+    /* Returns the value of the sessionId cookie. */
+    virtual std::string CreateSession(const std::map<std::string, std::string>& properties) = 0;
+
+    /* Returns nullptr for unknown or expired sessions. */
+    virtual std::shared_ptr<Session> OpenSession(const std::string& sessionId) = 0;
+
+    virtual void CloseSession(const std::string& sessionId) = 0;
+
+    virtual std::chrono::seconds GetLifetime() const = 0;
+
+    static SessionBackend& Get();
+    static void Set(std::shared_ptr<SessionBackend> backend);
+};
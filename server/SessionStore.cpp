@@ -0,0 +1,709 @@
+#include "SessionStore.hpp"
+
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Sessions that weren't used within their lifetime are refused as soon as
+   they expire, but their memory is only reclaimed by the sweep, which visits
+   one shard per interval. */
+constexpr auto SweepInterval = std::chrono::seconds(1);
+
+int64_t GetSessionClock()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t GetWallClock()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static thread_local std::mt19937 Engine = std::mt19937(std::random_device{}());
+static const std::string SessionIdAlphabet = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static std::uniform_int_distribution<size_t> SessionIdGenerator(0, SessionIdAlphabet.size() - 1);
+
+std::string GenerateRandomSessionId()
+{
+    std::string result = "";
+
+    for (size_t i = 0; i < SessionIdLength; i++)
+    {
+        result += SessionIdAlphabet[SessionIdGenerator(Engine)];
+    }
+
+    return result;
+}
+
+/* The log and the snapshot consist of the same records. The snapshot starts
+   with a header and is parsed in place from a mapping of the file. */
+enum class JournalRecord : uint8_t
+{
+    Create = 1,
+    Property = 2,
+    Close = 3
+};
+
+constexpr char SnapshotMagic[4] = { 'S', 'S', 'N', 'P' };
+constexpr uint32_t SnapshotVersion = 1;
+
+template<typename T>
+static void Put(std::string& output, T value)
+{
+    output.append((const char*)&value, sizeof(T));
+}
+
+static void PutString(std::string& output, const std::string& str)
+{
+    Put<uint32_t>(output, (uint32_t)str.size());
+    output += str;
+}
+
+struct RecordReader
+{
+    std::string_view m_Data;
+    size_t m_Offset = 0;
+
+    template<typename T>
+    bool Get(T& value)
+    {
+        if (m_Data.size() - m_Offset < sizeof(T))
+        {
+            return false;
+        }
+
+        std::copy_n(m_Data.data() + m_Offset, sizeof(T), (char*)&value);
+        m_Offset += sizeof(T);
+        return true;
+    }
+
+    bool GetString(std::string& str)
+    {
+        uint32_t length;
+        if (!Get(length) || m_Data.size() - m_Offset < length)
+        {
+            return false;
+        }
+
+        str.assign(m_Data.data() + m_Offset, length);
+        m_Offset += length;
+        return true;
+    }
+
+    bool AtEnd() const
+    {
+        return m_Offset == m_Data.size();
+    }
+};
+
+/* Read-only view of a whole file. */
+class MappedFile
+{
+private:
+#ifdef _WIN32
+    std::string m_Data;
+#else
+    void* m_Address = MAP_FAILED;
+    size_t m_Size = 0;
+#endif
+
+public:
+    MappedFile(const std::filesystem::path& path)
+    {
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary);
+        m_Data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            m_Size = (size_t)fileStat.st_size;
+            m_Address = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (m_Address != MAP_FAILED)
+        {
+            munmap(m_Address, m_Size);
+        }
+#endif
+    }
+
+    std::string_view GetData() const
+    {
+#ifdef _WIN32
+        return m_Data;
+#else
+        if (m_Address == MAP_FAILED)
+        {
+            return std::string_view();
+        }
+
+        return std::string_view((const char*)m_Address, m_Size);
+#endif
+    }
+};
+
+/* Writes the changes to the sessions off the request path. Requests only
+   append an encoded record to a buffer, a background thread writes the
+   buffer to the log and replaces the log with a snapshot of the store every
+   compaction interval. Changes of the last access time aren't logged, the
+   snapshot is what keeps them. */
+class SessionJournal
+{
+private:
+    using Shard = SessionStore::Shard;
+
+    SessionStore& m_Store;
+    std::filesystem::path m_LogPath;
+    std::filesystem::path m_SnapshotPath;
+    std::chrono::seconds m_CompactionInterval;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_ConditionVariable;
+    std::string m_Pending;
+    bool m_Stopping = false;
+
+    std::ofstream m_Log;
+    std::thread m_Thread;
+
+    struct RestoredSession
+    {
+        int64_t m_LastAccess = 0;
+        std::map<std::string, std::string> m_SessionData;
+    };
+
+    /* Stops at the first incomplete record, which is what a crash in the
+       middle of a write leaves behind. */
+    static void Replay(RecordReader reader, std::unordered_map<std::string, RestoredSession>& sessions)
+    {
+        while (!reader.AtEnd())
+        {
+            uint8_t type;
+            std::string sessionId;
+
+            if (!reader.Get(type) || !reader.GetString(sessionId))
+            {
+                return;
+            }
+
+            if (type == (uint8_t)JournalRecord::Create)
+            {
+                int64_t lastAccess;
+                if (!reader.Get(lastAccess))
+                {
+                    return;
+                }
+
+                /* Records from before the last compaction can be replayed on
+                   top of the snapshot, creating a session again mustn't drop
+                   its data. */
+                sessions[sessionId].m_LastAccess = std::max(sessions[sessionId].m_LastAccess, lastAccess);
+            }
+            else if (type == (uint8_t)JournalRecord::Property)
+            {
+                std::string key;
+                std::string value;
+                if (!reader.GetString(key) || !reader.GetString(value))
+                {
+                    return;
+                }
+
+                auto it = sessions.find(sessionId);
+                if (it != sessions.end())
+                {
+                    it->second.m_SessionData[key] = value;
+                }
+            }
+            else if (type == (uint8_t)JournalRecord::Close)
+            {
+                sessions.erase(sessionId);
+            }
+            else
+            {
+                return;
+            }
+        }
+    }
+
+    void Compact()
+    {
+        int64_t now = GetSessionClock();
+        int64_t wallNow = GetWallClock();
+
+        std::string snapshot(SnapshotMagic, sizeof(SnapshotMagic));
+        Put(snapshot, SnapshotVersion);
+
+        for (auto& shard : m_Store.m_Shards)
+        {
+            std::shared_lock guard(shard.m_Mutex);
+
+            for (auto& [sessionId, session] : shard.m_Sessions)
+            {
+                if (session->IsExpired(now))
+                {
+                    continue;
+                }
+
+                std::shared_lock dataGuard(session->m_DataMutex);
+
+                Put(snapshot, JournalRecord::Create);
+                PutString(snapshot, sessionId);
+                Put(snapshot, wallNow - (now - session->m_LastAccess.load(std::memory_order_relaxed)));
+
+                for (auto& [key, value] : session->m_SessionData)
+                {
+                    Put(snapshot, JournalRecord::Property);
+                    PutString(snapshot, sessionId);
+                    PutString(snapshot, key);
+                    PutString(snapshot, value);
+                }
+            }
+        }
+
+        auto temporaryPath = m_SnapshotPath;
+        temporaryPath += ".tmp";
+
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            file.write(snapshot.data(), snapshot.size());
+            if (!file.good())
+            {
+                std::cerr << "[!] Couldn't write the session snapshot\n";
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, m_SnapshotPath, error);
+        if (error)
+        {
+            std::cerr << "[!] Couldn't replace the session snapshot: " << error.message() << "\n";
+            return;
+        }
+
+        if (m_Log.is_open())
+        {
+            m_Log.close();
+        }
+        m_Log.clear();
+        m_Log.open(m_LogPath, std::ios::binary | std::ios::trunc);
+    }
+
+    void WriterThreadRoutine()
+    {
+        auto nextCompaction = std::chrono::steady_clock::now() + m_CompactionInterval;
+
+        while (true)
+        {
+            std::unique_lock lock(m_Mutex);
+
+            m_ConditionVariable.wait_until(lock, nextCompaction,
+                [&]()
+                {
+                    return !m_Pending.empty() || m_Stopping;
+                });
+
+            std::string pending = std::move(m_Pending);
+            m_Pending.clear();
+            bool stopping = m_Stopping;
+
+            lock.unlock();
+
+            if (!pending.empty())
+            {
+                m_Log.write(pending.data(), pending.size());
+                m_Log.flush();
+            }
+
+            if (stopping)
+            {
+                return;
+            }
+
+            if (std::chrono::steady_clock::now() >= nextCompaction)
+            {
+                Compact();
+                nextCompaction = std::chrono::steady_clock::now() + m_CompactionInterval;
+            }
+        }
+    }
+
+public:
+    SessionJournal(SessionStore& store,
+                   const std::filesystem::path& directory,
+                   std::chrono::seconds compactionInterval) :
+        m_Store(store),
+        m_LogPath(directory / "sessions.log"),
+        m_SnapshotPath(directory / "sessions.snapshot"),
+        m_CompactionInterval(compactionInterval)
+    {
+        std::filesystem::create_directories(directory);
+    }
+
+    ~SessionJournal()
+    {
+        if (m_Thread.joinable())
+        {
+            {
+                std::lock_guard lock(m_Mutex);
+                m_Stopping = true;
+            }
+
+            m_ConditionVariable.notify_all();
+            m_Thread.join();
+        }
+    }
+
+    /* Loads the snapshot and the log written after it into the store, then
+       starts a new log. Returns the number of restored sessions. */
+    size_t Restore()
+    {
+        std::unordered_map<std::string, RestoredSession> sessions;
+
+        {
+            MappedFile snapshot(m_SnapshotPath);
+            RecordReader reader{ snapshot.GetData() };
+
+            char magic[sizeof(SnapshotMagic)];
+            uint32_t version;
+
+            if (reader.Get(magic) &&
+                std::equal(std::begin(magic), std::end(magic), std::begin(SnapshotMagic)) &&
+                reader.Get(version) && version == SnapshotVersion)
+            {
+                Replay(reader, sessions);
+            }
+        }
+
+        {
+            MappedFile log(m_LogPath);
+            Replay(RecordReader{ log.GetData() }, sessions);
+        }
+
+        int64_t now = GetSessionClock();
+        int64_t wallNow = GetWallClock();
+        size_t restored = 0;
+
+        for (auto& [sessionId, restoredSession] : sessions)
+        {
+            auto session = std::make_shared<LoginSession>(
+                sessionId, now - (wallNow - restoredSession.m_LastAccess));
+
+            if (session->IsExpired(now))
+            {
+                continue;
+            }
+
+            session->m_SessionData = std::move(restoredSession.m_SessionData);
+
+            Shard& shard = m_Store.GetShard(sessionId);
+            shard.m_Sessions.try_emplace(sessionId, std::move(session));
+            restored++;
+        }
+
+        /* Compacting starts a new log, unless the snapshot couldn't be
+           written. */
+        Compact();
+        if (!m_Log.is_open())
+        {
+            m_Log.open(m_LogPath, std::ios::binary | std::ios::app);
+        }
+        m_Thread = std::thread(&SessionJournal::WriterThreadRoutine, this);
+
+        return restored;
+    }
+
+    void Append(const std::string& record)
+    {
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Pending += record;
+        }
+
+        m_ConditionVariable.notify_one();
+    }
+};
+
+static void SweepThreadRoutine()
+{
+    size_t shardIndex = 0;
+
+    while (true)
+    {
+        std::this_thread::sleep_for(SweepInterval);
+
+        SessionStore::Get().Sweep(shardIndex, GetSessionClock());
+        shardIndex = (shardIndex + 1) % SessionStore::GetShardCount();
+    }
+}
+
+static void StartSweepThread()
+{
+    static std::once_flag started;
+
+    std::call_once(started,
+        []()
+        {
+            std::thread(SweepThreadRoutine).detach();
+        });
+}
+
+SessionStore::SessionStore() = default;
+
+SessionStore::~SessionStore() = default;
+
+SessionStore& SessionStore::Get()
+{
+    static SessionStore store;
+    return store;
+}
+
+static std::shared_ptr<SessionBackend> SelectedBackend;
+
+SessionBackend& SessionBackend::Get()
+{
+    if (SelectedBackend == nullptr)
+    {
+        return SessionStore::Get();
+    }
+
+    return *SelectedBackend;
+}
+
+void SessionBackend::Set(std::shared_ptr<SessionBackend> backend)
+{
+    SelectedBackend = std::move(backend);
+}
+
+std::string SessionStore::CreateSession(const std::map<std::string, std::string>& properties)
+{
+    auto session = LoginSession::CreateSession();
+
+    for (auto& [key, value] : properties)
+    {
+        session->WriteProperty(key, value);
+    }
+
+    return session->m_SessionId;
+}
+
+std::shared_ptr<Session> SessionStore::OpenSession(const std::string& sessionId)
+{
+    int64_t now = GetSessionClock();
+
+    auto session = Find(sessionId, now);
+    if (session != nullptr)
+    {
+        session->ProlongSession(now);
+    }
+
+    return session;
+}
+
+void SessionStore::CloseSession(const std::string& sessionId)
+{
+    Erase(sessionId);
+}
+
+std::chrono::seconds SessionStore::GetLifetime() const
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(SessionLifetime);
+}
+
+std::shared_ptr<LoginSession> SessionStore::Find(const std::string& sessionId, int64_t now)
+{
+    Shard& shard = GetShard(sessionId);
+    std::shared_lock guard(shard.m_Mutex);
+
+    auto it = shard.m_Sessions.find(sessionId);
+    if (it == shard.m_Sessions.end() || it->second->IsExpired(now))
+    {
+        return nullptr;
+    }
+
+    return it->second;
+}
+
+bool SessionStore::Insert(const std::shared_ptr<LoginSession>& session)
+{
+    Shard& shard = GetShard(session->m_SessionId);
+    std::unique_lock guard(shard.m_Mutex);
+
+    if (!shard.m_Sessions.try_emplace(session->m_SessionId, session).second)
+    {
+        return false;
+    }
+
+    /* Journaled under the lock, so that the records of a session are in
+       the order of the changes. */
+    if (m_Journal != nullptr)
+    {
+        std::string record;
+        Put(record, JournalRecord::Create);
+        PutString(record, session->m_SessionId);
+        Put(record, GetWallClock());
+        m_Journal->Append(record);
+    }
+
+    return true;
+}
+
+std::shared_ptr<LoginSession> SessionStore::Erase(const std::string& sessionId)
+{
+    Shard& shard = GetShard(sessionId);
+    std::unique_lock guard(shard.m_Mutex);
+
+    auto it = shard.m_Sessions.find(sessionId);
+    if (it == shard.m_Sessions.end())
+    {
+        return nullptr;
+    }
+
+    auto session = std::move(it->second);
+    shard.m_Sessions.erase(it);
+
+    if (m_Journal != nullptr)
+    {
+        std::string record;
+        Put(record, JournalRecord::Close);
+        PutString(record, sessionId);
+        m_Journal->Append(record);
+    }
+
+    return session;
+}
+
+void SessionStore::Sweep(size_t shardIndex, int64_t now)
+{
+    Shard& shard = m_Shards[shardIndex % ShardCount];
+    std::vector<std::shared_ptr<LoginSession>> expired;
+
+    {
+        std::unique_lock guard(shard.m_Mutex);
+
+        std::erase_if(shard.m_Sessions,
+            [&](auto& entry)
+            {
+                if (!entry.second->IsExpired(now))
+                {
+                    return false;
+                }
+
+                expired.push_back(std::move(entry.second));
+                return true;
+            });
+    }
+}
+
+void SessionStore::EnablePersistence(const std::filesystem::path& directory,
+                                     std::chrono::seconds compactionInterval)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    m_Journal = std::make_unique<SessionJournal>(*this, directory, compactionInterval);
+    size_t restored = m_Journal->Restore();
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    std::cout << "[*] Restored " << restored << " sessions in " << duration.count() << " ms\n";
+
+    if (restored > 0)
+    {
+        StartSweepThread();
+    }
+}
+
+void SessionStore::JournalProperty(const LoginSession& session, const std::string& key, const std::string& value)
+{
+    if (m_Journal == nullptr)
+    {
+        return;
+    }
+
+    std::string record;
+    Put(record, JournalRecord::Property);
+    PutString(record, session.m_SessionId);
+    PutString(record, key);
+    PutString(record, value);
+    m_Journal->Append(record);
+}
+
+LoginSession::LoginSession(const std::string& sessionId, int64_t lastAccess) :
+    m_SessionId(sessionId), m_LastAccess(lastAccess)
+{
+}
+
+std::shared_ptr<LoginSession> LoginSession::CreateSession()
+{
+    StartSweepThread();
+
+    std::shared_ptr<LoginSession> session;
+
+    do
+    {
+        session = std::make_shared<LoginSession>(GenerateRandomSessionId(), GetSessionClock());
+    }
+    while (!SessionStore::Get().Insert(session));
+
+    return session;
+}
+
+void LoginSession::CloseSession()
+{
+    SessionStore::Get().Erase(this->m_SessionId);
+}
+
+std::string LoginSession::ReadProperty(const std::string& key)
+{
+    std::shared_lock guard(m_DataMutex);
+
+    auto it = m_SessionData.find(key);
+    if (it == m_SessionData.end())
+    {
+        return "";
+    }
+
+    return it->second;
+}
+
+std::string LoginSession::WriteProperty(const std::string& key, const std::string& value)
+{
+    std::unique_lock guard(m_DataMutex);
+
+    std::string old = m_SessionData[key];
+    m_SessionData[key] = value;
+
+    SessionStore::Get().JournalProperty(*this, key, value);
+    return old;
+}
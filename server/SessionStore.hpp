@@ -0,0 +1,125 @@
+#pragma once
+
+#include <map>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <filesystem>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "SessionBackend.hpp"
+
+constexpr auto SessionLifetime = std::chrono::hours(1);
+
+constexpr size_t SessionIdLength = 64;
+
+/* Seconds of a monotonic clock, the unit of LoginSession::m_LastAccess. The
+   clock is shared by all processes on the host. */
+int64_t GetSessionClock();
+
+std::string GenerateRandomSessionId();
+
+class SessionJournal;
+
+struct LoginSession : Session
+{
+    std::string m_SessionId;
+
+    /* In seconds of GetSessionClock. Only ordering within a second matters,
+       so relaxed accesses are enough. */
+    std::atomic<int64_t> m_LastAccess;
+
+    std::shared_mutex m_DataMutex;
+    std::map<std::string, std::string> m_SessionData;
+
+    static std::shared_ptr<LoginSession> CreateSession();
+    void CloseSession();
+
+    std::string ReadProperty(const std::string& key) override;
+    std::string WriteProperty(const std::string& key, const std::string& value) override;
+
+    bool IsExpired(int64_t now) const
+    {
+        auto lifetime = std::chrono::duration_cast<std::chrono::seconds>(SessionLifetime);
+        return now - m_LastAccess.load(std::memory_order_relaxed) > lifetime.count();
+    }
+
+    void ProlongSession(int64_t now)
+    {
+        /* Most accesses happen within the same second, skipping the store
+           keeps the cache line shared between the readers. */
+        if (m_LastAccess.load(std::memory_order_relaxed) != now)
+        {
+            m_LastAccess.store(now, std::memory_order_relaxed);
+        }
+    }
+
+    LoginSession(const std::string& sessionId, int64_t lastAccess);
+};
+
+/* Sessions are spread over shards by the hash of their ID, each with its own
+   reader/writer lock, so that concurrent lookups of different sessions don't
+   contend and lookups of the same one only share a lock. */
+class SessionStore : public SessionBackend
+{
+private:
+    static constexpr size_t ShardCount = 64;
+
+    struct alignas(64) Shard
+    {
+        std::shared_mutex m_Mutex;
+        std::unordered_map<std::string, std::shared_ptr<LoginSession>> m_Sessions;
+    };
+
+    std::array<Shard, ShardCount> m_Shards;
+    std::unique_ptr<SessionJournal> m_Journal;
+
+    friend class SessionJournal;
+
+    Shard& GetShard(const std::string& sessionId)
+    {
+        return m_Shards[std::hash<std::string>{}(sessionId) % ShardCount];
+    }
+
+    SessionStore();
+
+public:
+    ~SessionStore();
+
+    static SessionStore& Get();
+
+    std::string CreateSession(const std::map<std::string, std::string>& properties) override;
+    std::shared_ptr<Session> OpenSession(const std::string& sessionId) override;
+    void CloseSession(const std::string& sessionId) override;
+    std::chrono::seconds GetLifetime() const override;
+
+    /* Expired sessions are left for the sweep to remove, so that lookups
+       never need an exclusive lock. */
+    std::shared_ptr<LoginSession> Find(const std::string& sessionId, int64_t now);
+
+    /* Returns false if the ID is already taken. */
+    bool Insert(const std::shared_ptr<LoginSession>& session);
+
+    /* The session itself is destroyed outside of the lock. */
+    std::shared_ptr<LoginSession> Erase(const std::string& sessionId);
+
+    /* Removes the expired sessions of one shard. */
+    void Sweep(size_t shardIndex, int64_t now);
+
+    /* Restores the sessions saved in the directory and keeps saving changes
+       there: every change is appended to a log by a background thread, which
+       periodically compacts the log into a snapshot. Has to be called before
+       any session is created. */
+    void EnablePersistence(const std::filesystem::path& directory,
+                           std::chrono::seconds compactionInterval = std::chrono::minutes(5));
+
+    void JournalProperty(const LoginSession& session, const std::string& key, const std::string& value);
+
+    static constexpr size_t GetShardCount()
+    {
+        return ShardCount;
+    }
+};
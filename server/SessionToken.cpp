@@ -0,0 +1,504 @@
+#include "SessionToken.hpp"
+
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+constexpr uint8_t TokenVersion = 1;
+
+/* Truncated HMAC-SHA256, 128 bits are plenty for a tag that can only be
+   checked online, and keep the cookie short. */
+constexpr size_t TagSize = 16;
+
+/* Version, key period, expiration date, token ID and property count. */
+constexpr size_t HeaderSize = 1 + 4 + 8 + 8 + 1;
+
+static const char Base64UrlAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static std::string EncodeBase64Url(const std::string& data)
+{
+    std::string result;
+    result.reserve((data.size() * 4 + 2) / 3);
+
+    uint32_t accumulator = 0;
+    int bits = 0;
+
+    for (unsigned char byte : data)
+    {
+        accumulator = (accumulator << 8) | byte;
+        bits += 8;
+
+        while (bits >= 6)
+        {
+            bits -= 6;
+            result += Base64UrlAlphabet[(accumulator >> bits) & 0x3F];
+        }
+    }
+
+    if (bits > 0)
+    {
+        result += Base64UrlAlphabet[(accumulator << (6 - bits)) & 0x3F];
+    }
+
+    return result;
+}
+
+static bool DecodeBase64Url(const std::string& text, std::string& data)
+{
+    data.clear();
+    data.reserve(text.size() * 3 / 4);
+
+    uint32_t accumulator = 0;
+    int bits = 0;
+
+    for (char c : text)
+    {
+        int value;
+
+        if (c >= 'A' && c <= 'Z')
+        {
+            value = c - 'A';
+        }
+        else if (c >= 'a' && c <= 'z')
+        {
+            value = c - 'a' + 26;
+        }
+        else if (c >= '0' && c <= '9')
+        {
+            value = c - '0' + 52;
+        }
+        else if (c == '-')
+        {
+            value = 62;
+        }
+        else if (c == '_')
+        {
+            value = 63;
+        }
+        else
+        {
+            return false;
+        }
+
+        accumulator = (accumulator << 6) | (uint32_t)value;
+        bits += 6;
+
+        if (bits >= 8)
+        {
+            bits -= 8;
+            data += (char)((accumulator >> bits) & 0xFF);
+        }
+    }
+
+    return true;
+}
+
+template<typename T>
+static void Put(std::string& output, T value)
+{
+    output.append((const char*)&value, sizeof(T));
+}
+
+template<typename T>
+static bool Extract(const std::string& input, size_t& offset, T& value)
+{
+    if (input.size() - offset < sizeof(T))
+    {
+        return false;
+    }
+
+    std::copy_n(input.data() + offset, sizeof(T), (char*)&value);
+    offset += sizeof(T);
+    return true;
+}
+
+static int64_t GetWallClock()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/* Properties decoded from a token. Writes only change this copy, a new token
+   has to be issued for them to persist. */
+struct TokenSession : Session
+{
+    std::map<std::string, std::string> m_Properties;
+
+    std::string ReadProperty(const std::string& key) override
+    {
+        auto it = m_Properties.find(key);
+        if (it == m_Properties.end())
+        {
+            return "";
+        }
+
+        return it->second;
+    }
+
+    std::string WriteProperty(const std::string& key, const std::string& value) override
+    {
+        std::string old = m_Properties[key];
+        m_Properties[key] = value;
+        return old;
+    }
+};
+
+SessionTokens::SessionTokens(const std::string& masterSecret, const SessionTokenOptions& options) :
+    m_Options(options), m_MasterSecret(masterSecret)
+{
+    static std::atomic<uint64_t> Instances = 0;
+    m_Instance = ++Instances;
+
+    m_Options.m_KeyLifetime = std::max(m_Options.m_KeyLifetime, m_Options.m_Lifetime);
+
+    if (m_MasterSecret.empty())
+    {
+        m_MasterSecret.resize(KeySize);
+        if (RAND_bytes((unsigned char*)m_MasterSecret.data(), KeySize) <= 0)
+        {
+            throw std::runtime_error("Unable to generate the session token secret");
+        }
+    }
+
+    m_Revoked.store(std::make_shared<const RevocationSet>());
+}
+
+SessionTokens::SigningKey SessionTokens::DeriveKey(uint32_t period) const
+{
+    static const std::string Label = "session token key";
+
+    std::string input = Label;
+    Put(input, period);
+
+    SigningKey key;
+    key.m_Period = period;
+
+    unsigned int length = KeySize;
+    if (HMAC(EVP_sha256(),
+             m_MasterSecret.data(), (int)m_MasterSecret.size(),
+             (const unsigned char*)input.data(), input.size(),
+             key.m_Secret, &length) == nullptr)
+    {
+        throw std::runtime_error("Unable to derive the session token key");
+    }
+
+    return key;
+}
+
+std::shared_ptr<const SessionTokens::SigningKeys> SessionTokens::GetKeys(uint32_t period)
+{
+    auto keys = m_Keys.load();
+    if (keys != nullptr && keys->m_Current.m_Period == period)
+    {
+        return keys;
+    }
+
+    std::lock_guard guard(m_UpdateMutex);
+
+    keys = m_Keys.load();
+    if (keys != nullptr && keys->m_Current.m_Period == period)
+    {
+        return keys;
+    }
+
+    auto newKeys = std::make_shared<SigningKeys>();
+    newKeys->m_Current = DeriveKey(period);
+    newKeys->m_Previous = DeriveKey(period - 1);
+
+    m_Keys.store(newKeys);
+    return newKeys;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/* Setting up an HMAC fetches the digest and hashes the key, which costs
+   far more than signing a token. Each thread keeps contexts for the keys it
+   used last and only resets them. */
+struct KeyedMac
+{
+    uint64_t m_Instance = 0;
+    uint32_t m_Period = 0;
+    EVP_MAC_CTX* m_Ctx = nullptr;
+
+    ~KeyedMac()
+    {
+        EVP_MAC_CTX_free(m_Ctx);
+    }
+};
+
+static thread_local std::array<KeyedMac, 3> MacCache;
+static thread_local size_t MacCacheNext = 0;
+
+void SessionTokens::Sign(const SigningKey& key, const std::string& payload, unsigned char* tag) const
+{
+    static EVP_MAC* Mac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+
+    KeyedMac* entry = nullptr;
+    for (auto& cached : MacCache)
+    {
+        if (cached.m_Ctx != nullptr && cached.m_Instance == m_Instance && cached.m_Period == key.m_Period)
+        {
+            entry = &cached;
+            break;
+        }
+    }
+
+    bool initialized;
+
+    if (entry != nullptr)
+    {
+        initialized = EVP_MAC_init(entry->m_Ctx, nullptr, 0, nullptr) > 0;
+    }
+    else
+    {
+        entry = &MacCache[MacCacheNext];
+        MacCacheNext = (MacCacheNext + 1) % MacCache.size();
+
+        EVP_MAC_CTX_free(entry->m_Ctx);
+        entry->m_Ctx = EVP_MAC_CTX_new(Mac);
+        entry->m_Instance = m_Instance;
+        entry->m_Period = key.m_Period;
+
+        OSSL_PARAM params[] =
+        {
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0),
+            OSSL_PARAM_construct_end()
+        };
+
+        initialized = entry->m_Ctx != nullptr &&
+            EVP_MAC_init(entry->m_Ctx, key.m_Secret, KeySize, params) > 0;
+    }
+
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    size_t length = 0;
+
+    if (!initialized ||
+        EVP_MAC_update(entry->m_Ctx, (const unsigned char*)payload.data(), payload.size()) <= 0 ||
+        EVP_MAC_final(entry->m_Ctx, mac, &length, sizeof(mac)) <= 0)
+    {
+        EVP_MAC_CTX_free(entry->m_Ctx);
+        entry->m_Ctx = nullptr;
+        throw std::runtime_error("Unable to sign the session token");
+    }
+
+    std::copy_n(mac, TagSize, tag);
+}
+#else
+void SessionTokens::Sign(const SigningKey& key, const std::string& payload, unsigned char* tag) const
+{
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+
+    if (HMAC(EVP_sha256(), key.m_Secret, KeySize,
+             (const unsigned char*)payload.data(), payload.size(),
+             mac, &length) == nullptr)
+    {
+        throw std::runtime_error("Unable to sign the session token");
+    }
+
+    std::copy_n(mac, TagSize, tag);
+}
+#endif
+
+std::string SessionTokens::CreateSession(const std::map<std::string, std::string>& properties)
+{
+    if (properties.size() > UINT8_MAX)
+    {
+        throw std::runtime_error("Too many session token properties");
+    }
+
+    int64_t now = GetWallClock();
+    uint32_t period = (uint32_t)(now / m_Options.m_KeyLifetime.count());
+    auto keys = GetKeys(period);
+
+    uint64_t tokenId;
+    if (RAND_bytes((unsigned char*)&tokenId, sizeof(tokenId)) <= 0)
+    {
+        throw std::runtime_error("Unable to generate a session token ID");
+    }
+
+    std::string payload;
+    Put(payload, TokenVersion);
+    Put(payload, period);
+    Put(payload, now + m_Options.m_Lifetime.count());
+    Put(payload, tokenId);
+    Put(payload, (uint8_t)properties.size());
+
+    for (auto& [key, value] : properties)
+    {
+        if (key.size() > UINT8_MAX || value.size() > UINT16_MAX)
+        {
+            throw std::runtime_error("Session token property is too long");
+        }
+
+        Put(payload, (uint8_t)key.size());
+        payload += key;
+        Put(payload, (uint16_t)value.size());
+        payload += value;
+    }
+
+    unsigned char tag[TagSize];
+    Sign(keys->m_Current, payload, tag);
+    payload.append((const char*)tag, TagSize);
+
+    return EncodeBase64Url(payload);
+}
+
+bool SessionTokens::Verify(const std::string& token,
+                           std::map<std::string, std::string>& properties,
+                           uint64_t& tokenId,
+                           int64_t& expiration)
+{
+    std::string data;
+    if (!DecodeBase64Url(token, data) || data.size() < HeaderSize + TagSize)
+    {
+        return false;
+    }
+
+    std::string payload = data.substr(0, data.size() - TagSize);
+
+    size_t offset = 0;
+    uint8_t version;
+    uint32_t period;
+    uint8_t count;
+
+    Extract(payload, offset, version);
+    Extract(payload, offset, period);
+    Extract(payload, offset, expiration);
+    Extract(payload, offset, tokenId);
+    Extract(payload, offset, count);
+
+    if (version != TokenVersion)
+    {
+        return false;
+    }
+
+    int64_t now = GetWallClock();
+    uint32_t currentPeriod = (uint32_t)(now / m_Options.m_KeyLifetime.count());
+    auto keys = GetKeys(currentPeriod);
+
+    /* A server whose clock is slightly ahead may already sign with the key
+       of the next period. */
+    SigningKey nextKey;
+    const SigningKey* key;
+
+    if (period == keys->m_Current.m_Period)
+    {
+        key = &keys->m_Current;
+    }
+    else if (period == keys->m_Previous.m_Period)
+    {
+        key = &keys->m_Previous;
+    }
+    else if (period == currentPeriod + 1)
+    {
+        nextKey = DeriveKey(period);
+        key = &nextKey;
+    }
+    else
+    {
+        return false;
+    }
+
+    unsigned char tag[TagSize];
+    Sign(*key, payload, tag);
+
+    if (CRYPTO_memcmp(tag, data.data() + payload.size(), TagSize) != 0 || expiration < now)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint8_t keyLength;
+        uint16_t valueLength;
+        std::string propertyKey;
+
+        if (!Extract(payload, offset, keyLength) || payload.size() - offset < keyLength)
+        {
+            return false;
+        }
+
+        propertyKey = payload.substr(offset, keyLength);
+        offset += keyLength;
+
+        if (!Extract(payload, offset, valueLength) || payload.size() - offset < valueLength)
+        {
+            return false;
+        }
+
+        properties[propertyKey] = payload.substr(offset, valueLength);
+        offset += valueLength;
+    }
+
+    return offset == payload.size();
+}
+
+std::shared_ptr<Session> SessionTokens::OpenSession(const std::string& sessionId)
+{
+    auto session = std::make_shared<TokenSession>();
+    uint64_t tokenId;
+    int64_t expiration;
+
+    if (!Verify(sessionId, session->m_Properties, tokenId, expiration))
+    {
+        return nullptr;
+    }
+
+    auto revoked = m_Revoked.load();
+    if (!revoked->empty() && revoked->contains(tokenId))
+    {
+        return nullptr;
+    }
+
+    return session;
+}
+
+void SessionTokens::CloseSession(const std::string& sessionId)
+{
+    std::map<std::string, std::string> properties;
+    uint64_t tokenId;
+    int64_t expiration;
+
+    if (!Verify(sessionId, properties, tokenId, expiration))
+    {
+        return;
+    }
+
+    std::lock_guard guard(m_UpdateMutex);
+
+    /* Readers keep using the old set, the copy replaces it once complete. */
+    auto revoked = std::make_shared<RevocationSet>(*m_Revoked.load());
+    int64_t now = GetWallClock();
+
+    std::erase_if(*revoked,
+        [&](auto& entry)
+        {
+            return entry.second < now;
+        });
+
+    /* Only expired revocations can be forgotten, the token stays valid
+       until it expires rather than failing the request. */
+    if (revoked->size() >= m_Options.m_MaxRevoked)
+    {
+        std::cerr << "[!] Too many revoked session tokens, token " << tokenId << " stays valid\n";
+        return;
+    }
+
+    revoked->emplace(tokenId, expiration);
+    m_Revoked.store(std::move(revoked));
+}
+
+std::chrono::seconds SessionTokens::GetLifetime() const
+{
+    return m_Options.m_Lifetime;
+}
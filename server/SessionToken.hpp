@@ -0,0 +1,84 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include "SessionBackend.hpp"
+
+struct SessionTokenOptions
+{
+    std::chrono::seconds m_Lifetime = std::chrono::hours(1);
+
+    /* How long one key signs new tokens. Tokens are accepted with the current
+       and the previous key, so it can't be shorter than the lifetime. */
+    std::chrono::seconds m_KeyLifetime = std::chrono::hours(12);
+
+    /* Revoked tokens are remembered until they expire. */
+    size_t m_MaxRevoked = 4096;
+};
+
+/* Sessions kept entirely in the cookie: the properties and the expiration
+   date, signed with HMAC-SHA256. Opening a session is a signature check,
+   without any lookup, lock or memory kept per session.
+
+   The signing keys are derived from a master secret and the current key
+   period, so servers sharing the secret accept each other's tokens and
+   rotate keys at the same time without communicating. Revocations are only
+   known to the server they were made on. */
+class SessionTokens : public SessionBackend
+{
+private:
+    static constexpr size_t KeySize = 32;
+
+    struct SigningKey
+    {
+        uint32_t m_Period;
+        unsigned char m_Secret[KeySize];
+    };
+
+    struct SigningKeys
+    {
+        SigningKey m_Current;
+        SigningKey m_Previous;
+    };
+
+    using RevocationSet = std::unordered_map<uint64_t, int64_t>;
+
+    SessionTokenOptions m_Options;
+    std::string m_MasterSecret;
+
+    /* Identifies the keys in per-thread caches. */
+    uint64_t m_Instance;
+
+    std::mutex m_UpdateMutex;
+    std::atomic<std::shared_ptr<const SigningKeys>> m_Keys;
+    std::atomic<std::shared_ptr<const RevocationSet>> m_Revoked;
+
+    SigningKey DeriveKey(uint32_t period) const;
+    void Sign(const SigningKey& key, const std::string& payload, unsigned char* tag) const;
+    std::shared_ptr<const SigningKeys> GetKeys(uint32_t period);
+
+    /* Returns false if the token is malformed, forged or expired. */
+    bool Verify(const std::string& token,
+                std::map<std::string, std::string>& properties,
+                uint64_t& tokenId,
+                int64_t& expiration);
+
+public:
+    /* Servers that have to accept each other's tokens need the same secret,
+       an empty one is replaced with a random secret. */
+    SessionTokens(const std::string& masterSecret = "",
+                  const SessionTokenOptions& options = SessionTokenOptions());
+
+    std::string CreateSession(const std::map<std::string, std::string>& properties) override;
+    std::shared_ptr<Session> OpenSession(const std::string& sessionId) override;
+
+    /* Revokes the token until it expires. If too many tokens are revoked
+       already, it is left valid. */
+    void CloseSession(const std::string& sessionId) override;
+
+    std::chrono::seconds GetLifetime() const override;
+};
@@ -0,0 +1,621 @@
+#include "SharedSessionStore.hpp"
+#include "SessionStore.hpp"
+
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <stdexcept>
+
+#include <openssl/rand.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+constexpr uint32_t SegmentMagic = 0x53534853;
+constexpr uint32_t SegmentVersion = 1;
+
+constexpr size_t BucketSize = 512;
+
+/* Buckets probed for a session before giving up, which bounds the cost of
+   lookups in a nearly full table. */
+constexpr size_t MaxProbes = 128;
+
+/* Spins on a locked bucket before checking whether its owner is alive. */
+constexpr size_t SpinsBeforeOwnerCheck = 1024;
+
+enum SegmentState : uint32_t
+{
+    Uninitialized = 0,
+    Initializing = 1,
+    Ready = 2
+};
+
+enum BucketState : uint32_t
+{
+    Empty = 0,
+    Used = 1,
+    Deleted = 2
+};
+
+/* The state is in the low half of the word and the PID of the initializing
+   process in the high half, so that a process can't claim the segment
+   without also publishing who it is. */
+struct SharedSessionStore::Header
+{
+    std::atomic<uint64_t> m_State;
+    uint32_t m_Magic;
+    uint32_t m_Version;
+    uint64_t m_Capacity;
+    char m_Padding[40];
+};
+
+/* Only the atomics may be accessed outside of the bucket lock. Readers copy
+   the rest and discard the copy if the sequence changed meanwhile. The
+   sequence is in the low half of the lock word and the PID of the process
+   holding the lock in the high half, both change in one operation. */
+struct SharedSessionStore::Bucket
+{
+    std::atomic<uint64_t> m_Lock;
+    std::atomic<int64_t> m_LastAccess;
+    uint32_t m_State;
+    uint16_t m_DataLength;
+    char m_SessionId[SessionIdLength];
+    char m_Data[BucketSize - 22 - SessionIdLength];
+};
+
+static_assert(sizeof(SharedSessionStore::Header) == 64);
+static_assert(sizeof(SharedSessionStore::Bucket) == BucketSize);
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+              std::atomic<int64_t>::is_always_lock_free,
+              "Atomics in shared memory have to be lock free");
+
+static uint64_t MakeWord(uint32_t low, int32_t pid)
+{
+    return ((uint64_t)(uint32_t)pid << 32) | low;
+}
+
+static uint32_t GetLow(uint64_t word)
+{
+    return (uint32_t)word;
+}
+
+static int32_t GetPid(uint64_t word)
+{
+    return (int32_t)(word >> 32);
+}
+
+/* From OpenSSL rather than the per-thread engine of SessionStore, whose
+   state a forked process would share with its parent and repeat the same
+   IDs. */
+static std::string GenerateSharedSessionId()
+{
+    static const char Alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    constexpr unsigned AlphabetSize = sizeof(Alphabet) - 1;
+
+    std::string sessionId;
+    unsigned char bytes[SessionIdLength];
+
+    while (sessionId.size() < SessionIdLength)
+    {
+        if (RAND_bytes(bytes, sizeof(bytes)) != 1)
+        {
+            throw std::runtime_error("Unable to generate a session ID");
+        }
+
+        /* Bytes past the last whole multiple of the alphabet would favor
+           its first characters. */
+        for (unsigned char byte : bytes)
+        {
+            if (byte < 256 / AlphabetSize * AlphabetSize && sessionId.size() < SessionIdLength)
+            {
+                sessionId += Alphabet[byte % AlphabetSize];
+            }
+        }
+    }
+
+    return sessionId;
+}
+
+/* The properties are stored as a length-prefixed key and value each. */
+static std::string SerializeProperties(const std::map<std::string, std::string>& properties)
+{
+    std::string data;
+
+    for (auto& [key, value] : properties)
+    {
+        if (key.size() > UINT8_MAX || value.size() > UINT16_MAX)
+        {
+            throw std::runtime_error("Session property is too long");
+        }
+
+        uint16_t valueLength = (uint16_t)value.size();
+
+        data += (char)key.size();
+        data += key;
+        data.append((const char*)&valueLength, sizeof(valueLength));
+        data += value;
+    }
+
+    if (data.size() > sizeof(SharedSessionStore::Bucket::m_Data))
+    {
+        throw std::runtime_error("Session properties don't fit in a shared bucket");
+    }
+
+    return data;
+}
+
+static std::map<std::string, std::string> DeserializeProperties(const std::string& data)
+{
+    std::map<std::string, std::string> properties;
+    size_t offset = 0;
+
+    while (offset < data.size())
+    {
+        size_t keyLength = (unsigned char)data[offset++];
+        uint16_t valueLength;
+
+        if (data.size() - offset < keyLength + sizeof(valueLength))
+        {
+            break;
+        }
+
+        std::string key = data.substr(offset, keyLength);
+        offset += keyLength;
+
+        std::memcpy(&valueLength, data.data() + offset, sizeof(valueLength));
+        offset += sizeof(valueLength);
+
+        if (data.size() - offset < valueLength)
+        {
+            break;
+        }
+
+        properties[key] = data.substr(offset, valueLength);
+        offset += valueLength;
+    }
+
+    return properties;
+}
+
+#ifdef _WIN32
+static int32_t GetOwnProcessId()
+{
+    return 1;
+}
+
+static bool IsProcessAlive(int32_t pid)
+{
+    return true;
+}
+#else
+static int32_t GetOwnProcessId()
+{
+    return (int32_t)getpid();
+}
+
+static bool IsProcessAlive(int32_t pid)
+{
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+#endif
+
+struct SharedSessionStore::SharedSession : Session
+{
+    SharedSessionStore* m_Store;
+    std::string m_SessionId;
+    std::map<std::string, std::string> m_Properties;
+
+    std::string ReadProperty(const std::string& key) override
+    {
+        auto it = m_Properties.find(key);
+        if (it == m_Properties.end())
+        {
+            return "";
+        }
+
+        return it->second;
+    }
+
+    std::string WriteProperty(const std::string& key, const std::string& value) override
+    {
+        std::string old = m_Properties[key];
+        m_Properties[key] = value;
+
+        m_Store->WriteProperty(m_SessionId, key, value);
+        return old;
+    }
+};
+
+#ifdef _WIN32
+SharedSessionStore::SharedSessionStore(const std::string& name, size_t capacity)
+{
+    throw std::runtime_error("Shared memory sessions are only supported on POSIX systems");
+}
+
+SharedSessionStore::~SharedSessionStore()
+{
+}
+
+void SharedSessionStore::Unlink(const std::string& name)
+{
+}
+#else
+SharedSessionStore::SharedSessionStore(const std::string& name, size_t capacity) :
+    m_Name(name), m_Capacity(capacity)
+{
+    if (capacity == 0)
+    {
+        throw std::runtime_error("Shared session store needs a capacity");
+    }
+
+    m_MappingSize = sizeof(Header) + capacity * sizeof(Bucket);
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Unable to open the shared session segment " + name);
+    }
+
+    /* A new segment is zero-filled, which is what an uninitialized header
+       and empty buckets look like. */
+    struct stat segmentStat;
+    if (fstat(fd, &segmentStat) != 0 ||
+        ((size_t)segmentStat.st_size < m_MappingSize && ftruncate(fd, (off_t)m_MappingSize) != 0))
+    {
+        close(fd);
+        throw std::runtime_error("Unable to size the shared session segment " + name);
+    }
+
+    void* address = mmap(nullptr, m_MappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (address == MAP_FAILED)
+    {
+        throw std::runtime_error("Unable to map the shared session segment " + name);
+    }
+
+    m_Header = (Header*)address;
+    m_Buckets = (Bucket*)((char*)address + sizeof(Header));
+
+    while (true)
+    {
+        uint64_t word = m_Header->m_State.load(std::memory_order_acquire);
+        uint32_t state = GetLow(word);
+
+        if (state == Ready)
+        {
+            break;
+        }
+
+        if (state == Uninitialized)
+        {
+            if (!m_Header->m_State.compare_exchange_strong(
+                    word, MakeWord(Initializing, GetOwnProcessId()), std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            /* The segment could have been left half-initialized. */
+            std::memset((void*)m_Buckets, 0, capacity * sizeof(Bucket));
+
+            m_Header->m_Magic = SegmentMagic;
+            m_Header->m_Version = SegmentVersion;
+            m_Header->m_Capacity = capacity;
+
+            m_Header->m_State.store(MakeWord(Ready, 0), std::memory_order_release);
+            break;
+        }
+
+        /* Initialization of a process that died is started again. */
+        if (!IsProcessAlive(GetPid(word)))
+        {
+            m_Header->m_State.compare_exchange_strong(word, MakeWord(Uninitialized, 0));
+            continue;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (m_Header->m_Magic != SegmentMagic ||
+        m_Header->m_Version != SegmentVersion ||
+        m_Header->m_Capacity != capacity)
+    {
+        munmap(address, m_MappingSize);
+        throw std::runtime_error("Shared session segment " + name + " has a different layout");
+    }
+}
+
+SharedSessionStore::~SharedSessionStore()
+{
+    if (m_Header != nullptr)
+    {
+        munmap(m_Header, m_MappingSize);
+    }
+}
+
+void SharedSessionStore::Unlink(const std::string& name)
+{
+    shm_unlink(name.c_str());
+}
+#endif
+
+void SharedSessionStore::LockBucket(Bucket& bucket) const
+{
+    size_t spins = 0;
+
+    while (true)
+    {
+        uint64_t word = bucket.m_Lock.load(std::memory_order_relaxed);
+        uint32_t sequence = GetLow(word);
+
+        if ((sequence & 1) == 0)
+        {
+            if (bucket.m_Lock.compare_exchange_weak(
+                    word, MakeWord(sequence + 1, GetOwnProcessId()), std::memory_order_acquire))
+            {
+                return;
+            }
+            continue;
+        }
+
+        if (++spins % SpinsBeforeOwnerCheck == 0 && !IsProcessAlive(GetPid(word)))
+        {
+            /* The lock was left behind by a process that died. Its write may
+               be incomplete, so the bucket is discarded. */
+            if (bucket.m_Lock.compare_exchange_strong(
+                    word, MakeWord(sequence + 2, GetOwnProcessId()), std::memory_order_acquire))
+            {
+                bucket.m_State = Deleted;
+                bucket.m_DataLength = 0;
+                return;
+            }
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+void SharedSessionStore::UnlockBucket(Bucket& bucket) const
+{
+    uint32_t sequence = GetLow(bucket.m_Lock.load(std::memory_order_relaxed));
+    bucket.m_Lock.store(MakeWord(sequence + 1, 0), std::memory_order_release);
+}
+
+bool SharedSessionStore::ReadBucket(const Bucket& bucket,
+                                    const std::string& sessionId,
+                                    std::string& data,
+                                    bool& empty) const
+{
+    size_t spins = 0;
+
+    while (true)
+    {
+        uint32_t sequence = GetLow(bucket.m_Lock.load(std::memory_order_acquire));
+
+        if ((sequence & 1) != 0)
+        {
+            /* Locking recovers the bucket if its writer died. */
+            if (++spins % SpinsBeforeOwnerCheck == 0)
+            {
+                LockBucket(const_cast<Bucket&>(bucket));
+                UnlockBucket(const_cast<Bucket&>(bucket));
+            }
+
+            std::this_thread::yield();
+            continue;
+        }
+
+        uint32_t state = bucket.m_State;
+        bool found = state == Used &&
+            std::memcmp(bucket.m_SessionId, sessionId.data(), SessionIdLength) == 0;
+
+        if (found)
+        {
+            size_t length = std::min<size_t>(bucket.m_DataLength, sizeof(bucket.m_Data));
+            data.assign(bucket.m_Data, length);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (GetLow(bucket.m_Lock.load(std::memory_order_relaxed)) != sequence)
+        {
+            continue;
+        }
+
+        empty = state == Empty;
+        return found;
+    }
+}
+
+size_t SharedSessionStore::GetHome(const std::string& sessionId) const
+{
+    /* Has to be the same in every process, which std::hash doesn't promise
+       across builds. */
+    uint64_t hash = 14695981039346656037ull;
+
+    for (char c : sessionId)
+    {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+    }
+
+    return hash % m_Capacity;
+}
+
+std::string SharedSessionStore::CreateSession(const std::map<std::string, std::string>& properties)
+{
+    std::string data = SerializeProperties(properties);
+
+    /* Session IDs are random enough that they are not checked for
+       duplicates. */
+    std::string sessionId = GenerateSharedSessionId();
+    size_t home = GetHome(sessionId);
+    int64_t now = GetSessionClock();
+
+    for (size_t i = 0; i < std::min(MaxProbes, m_Capacity); i++)
+    {
+        Bucket& bucket = m_Buckets[(home + i) % m_Capacity];
+
+        LockBucket(bucket);
+
+        auto lifetime = std::chrono::duration_cast<std::chrono::seconds>(SessionLifetime).count();
+        bool expired = now - bucket.m_LastAccess.load(std::memory_order_relaxed) > lifetime;
+
+        if (bucket.m_State != Used || expired)
+        {
+            bucket.m_State = Used;
+            bucket.m_LastAccess.store(now, std::memory_order_relaxed);
+            std::memcpy(bucket.m_SessionId, sessionId.data(), SessionIdLength);
+            std::memcpy(bucket.m_Data, data.data(), data.size());
+            bucket.m_DataLength = (uint16_t)data.size();
+
+            UnlockBucket(bucket);
+            return sessionId;
+        }
+
+        UnlockBucket(bucket);
+    }
+
+    throw std::runtime_error("Shared session store is full");
+}
+
+std::shared_ptr<Session> SharedSessionStore::OpenSession(const std::string& sessionId)
+{
+    if (sessionId.size() != SessionIdLength)
+    {
+        return nullptr;
+    }
+
+    size_t home = GetHome(sessionId);
+    int64_t now = GetSessionClock();
+    std::string data;
+
+    for (size_t i = 0; i < std::min(MaxProbes, m_Capacity); i++)
+    {
+        Bucket& bucket = m_Buckets[(home + i) % m_Capacity];
+        bool empty;
+
+        if (ReadBucket(bucket, sessionId, data, empty))
+        {
+            int64_t lastAccess = bucket.m_LastAccess.load(std::memory_order_relaxed);
+            auto lifetime = std::chrono::duration_cast<std::chrono::seconds>(SessionLifetime).count();
+
+            if (now - lastAccess > lifetime)
+            {
+                return nullptr;
+            }
+
+            if (lastAccess != now)
+            {
+                bucket.m_LastAccess.store(now, std::memory_order_relaxed);
+            }
+
+            auto session = std::make_shared<SharedSession>();
+            session->m_Store = this;
+            session->m_SessionId = sessionId;
+            session->m_Properties = DeserializeProperties(data);
+            return session;
+        }
+
+        if (empty)
+        {
+            return nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+bool SharedSessionStore::WriteProperty(const std::string& sessionId,
+                                       const std::string& key,
+                                       const std::string& value)
+{
+    size_t home = GetHome(sessionId);
+
+    for (size_t i = 0; i < std::min(MaxProbes, m_Capacity); i++)
+    {
+        Bucket& bucket = m_Buckets[(home + i) % m_Capacity];
+
+        LockBucket(bucket);
+
+        if (bucket.m_State == Empty)
+        {
+            UnlockBucket(bucket);
+            return false;
+        }
+
+        if (bucket.m_State != Used ||
+            std::memcmp(bucket.m_SessionId, sessionId.data(), SessionIdLength) != 0)
+        {
+            UnlockBucket(bucket);
+            continue;
+        }
+
+        auto properties = DeserializeProperties(std::string(bucket.m_Data, bucket.m_DataLength));
+        properties[key] = value;
+
+        std::string data;
+        try
+        {
+            data = SerializeProperties(properties);
+        }
+        catch (...)
+        {
+            UnlockBucket(bucket);
+            throw;
+        }
+
+        std::memcpy(bucket.m_Data, data.data(), data.size());
+        bucket.m_DataLength = (uint16_t)data.size();
+
+        UnlockBucket(bucket);
+        return true;
+    }
+
+    return false;
+}
+
+void SharedSessionStore::CloseSession(const std::string& sessionId)
+{
+    if (sessionId.size() != SessionIdLength)
+    {
+        return;
+    }
+
+    size_t home = GetHome(sessionId);
+
+    for (size_t i = 0; i < std::min(MaxProbes, m_Capacity); i++)
+    {
+        Bucket& bucket = m_Buckets[(home + i) % m_Capacity];
+
+        LockBucket(bucket);
+
+        bool empty = bucket.m_State == Empty;
+        bool found = bucket.m_State == Used &&
+            std::memcmp(bucket.m_SessionId, sessionId.data(), SessionIdLength) == 0;
+
+        /* Deleted buckets keep the probe sequences of other sessions
+           intact. */
+        if (found)
+        {
+            bucket.m_State = Deleted;
+            bucket.m_DataLength = 0;
+        }
+
+        UnlockBucket(bucket);
+
+        if (found || empty)
+        {
+            return;
+        }
+    }
+}
+
+std::chrono::seconds SharedSessionStore::GetLifetime() const
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(SessionLifetime);
+}
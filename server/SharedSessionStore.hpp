@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+
+#include "SessionBackend.hpp"
+
+/* Sessions kept in a POSIX shared memory segment, so that every server
+   process on the host sees the sessions created by the others. The segment
+   holds a fixed-capacity open-addressing hash table. Each bucket is guarded
+   by a sequence lock: readers copy it without writing to shared memory and
+   retry if a writer changed it in the meantime, writers lock the bucket by
+   making its sequence odd.
+
+   The process that creates the segment initializes it, the others wait for
+   it. A process that dies while initializing or while holding a bucket lock
+   is detected by its PID, and the work it left unfinished is taken over or
+   discarded. */
+class SharedSessionStore : public SessionBackend
+{
+public:
+    struct Header;
+    struct Bucket;
+
+    /* Open sessions keep a copy of their properties, writes go to the
+       segment as well. */
+    struct SharedSession;
+
+private:
+    std::string m_Name;
+    Header* m_Header = nullptr;
+    Bucket* m_Buckets = nullptr;
+    size_t m_MappingSize = 0;
+    size_t m_Capacity = 0;
+
+    /* Copies the bucket if it holds the session, the copy is consistent even
+       if the bucket is concurrently written. */
+    bool ReadBucket(const Bucket& bucket,
+                    const std::string& sessionId,
+                    std::string& data,
+                    bool& empty) const;
+
+    void LockBucket(Bucket& bucket) const;
+    void UnlockBucket(Bucket& bucket) const;
+
+    size_t GetHome(const std::string& sessionId) const;
+
+    bool WriteProperty(const std::string& sessionId, const std::string& key, const std::string& value);
+
+public:
+    /* Every process of a deployment has to use the same name and capacity.
+       The capacity is the number of buckets, each about half a kilobyte. */
+    SharedSessionStore(const std::string& name = "/server-sessions", size_t capacity = 16384);
+
+    SharedSessionStore(const SharedSessionStore&) = delete;
+    SharedSessionStore& operator=(const SharedSessionStore&) = delete;
+
+    ~SharedSessionStore();
+
+    std::string CreateSession(const std::map<std::string, std::string>& properties) override;
+    std::shared_ptr<Session> OpenSession(const std::string& sessionId) override;
+    void CloseSession(const std::string& sessionId) override;
+    std::chrono::seconds GetLifetime() const override;
+
+    /* Removes the segment, sessions in it are lost once the last process
+       detaches from it. */
+    static void Unlink(const std::string& name = "/server-sessions");
+};
@@ -0,0 +1,481 @@
+#include "TarExtractor.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+using namespace std::filesystem;
+
+constexpr size_t BlockSize = 512;
+
+/* Long names and pax headers are kept in memory, nothing legitimate comes
+   close to that. */
+constexpr size_t MaxMetadataSize = 64 * 1024;
+
+/* Bounds the descriptors an archive of many small files holds open. */
+constexpr size_t MaxUnsyncedFiles = 64;
+
+static std::string_view GetField(const std::string& header, size_t offset, size_t size)
+{
+    std::string_view field(header.data() + offset, size);
+    return field.substr(0, field.find('\0'));
+}
+
+/* Octal, or big-endian binary if the high bit of the first byte is set,
+   which is how GNU tar stores sizes too large for the octal field. */
+static size_t ParseNumber(const std::string& header, size_t offset, size_t size)
+{
+    const unsigned char* field = (const unsigned char*)header.data() + offset;
+
+    if (field[0] & 0x80)
+    {
+        size_t value = field[0] & 0x7F;
+        for (size_t i = 1; i < size; i++)
+        {
+            value = (value << 8) | field[i];
+        }
+
+        return value;
+    }
+
+    size_t value = 0;
+    for (size_t i = 0; i < size && field[i] != '\0' && field[i] != ' '; i++)
+    {
+        if (field[i] < '0' || field[i] > '7')
+        {
+            throw std::runtime_error("Invalid number in an archive header");
+        }
+
+        value = value * 8 + (field[i] - '0');
+    }
+
+    return value;
+}
+
+/* Sum of the header bytes with the checksum field itself as spaces. Some
+   archivers sum signed bytes, either is accepted. */
+static bool IsChecksumValid(const std::string& header)
+{
+    size_t expected = ParseNumber(header, 148, 8);
+
+    long unsignedSum = 0;
+    long signedSum = 0;
+    for (size_t i = 0; i < BlockSize; i++)
+    {
+        char byte = (i >= 148 && i < 156) ? ' ' : header[i];
+        unsignedSum += (unsigned char)byte;
+        signedSum += (signed char)byte;
+    }
+
+    return (size_t)unsignedSum == expected || (size_t)signedSum == expected;
+}
+
+#ifdef _WIN32
+TarExtractor::TarExtractor(const path& directory) :
+    m_Directory(directory),
+    m_File(nullptr)
+{
+}
+
+TarExtractor::~TarExtractor()
+{
+    if (m_File != nullptr)
+    {
+        CloseHandle(m_File);
+
+        std::error_code error;
+        remove(m_Current.m_Path, error);
+    }
+}
+
+void TarExtractor::OpenFile(const std::string& name, size_t size)
+{
+    path filePath = m_Directory / name;
+
+    HANDLE file = CreateFileW(filePath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        if (GetLastError() != ERROR_FILE_EXISTS)
+        {
+            throw std::runtime_error("Couldn't create " + filePath.string());
+        }
+
+        m_Files.push_back(ExtractedFile{ filePath, size, true });
+        m_EntryType = EntryType::Skipped;
+        return;
+    }
+
+    m_File = file;
+    m_Current = ExtractedFile{ filePath, size, false };
+}
+
+void TarExtractor::WriteFile(std::string_view data)
+{
+    while (!data.empty())
+    {
+        DWORD written = 0;
+        if (!::WriteFile(m_File, data.data(), (DWORD)std::min<size_t>(data.size(), 1 << 30), &written, nullptr))
+        {
+            throw std::runtime_error("Couldn't write " + m_Current.m_Path.string());
+        }
+
+        data.remove_prefix(written);
+    }
+}
+
+/* There is nothing to sync a whole directory with, so every file is
+   flushed on its own. */
+void TarExtractor::CloseFile()
+{
+    if (!FlushFileBuffers(m_File))
+    {
+        throw std::runtime_error("Couldn't sync " + m_Current.m_Path.string());
+    }
+
+    CloseHandle(m_File);
+    m_File = nullptr;
+    m_Files.push_back(std::move(m_Current));
+}
+#else
+TarExtractor::TarExtractor(const path& directory) :
+    m_Directory(directory)
+{
+    m_DirectoryDescriptor = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_DirectoryDescriptor < 0)
+    {
+        throw std::runtime_error("Couldn't open " + directory.string() + ": " + strerror(errno));
+    }
+}
+
+TarExtractor::~TarExtractor()
+{
+    if (m_File >= 0)
+    {
+        close(m_File);
+        unlinkat(m_DirectoryDescriptor, m_Current.m_Path.filename().c_str(), 0);
+    }
+
+    for (int file : m_UnsyncedFiles)
+    {
+        close(file);
+    }
+
+    close(m_DirectoryDescriptor);
+}
+
+void TarExtractor::OpenFile(const std::string& name, size_t size)
+{
+    path filePath = m_Directory / name;
+
+    /* Creating it exclusively checks whether it exists in the same call. */
+    int file = openat(m_DirectoryDescriptor, name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (file < 0)
+    {
+        if (errno != EEXIST)
+        {
+            throw std::runtime_error("Couldn't create " + filePath.string() + ": " + strerror(errno));
+        }
+
+        m_Files.push_back(ExtractedFile{ filePath, size, true });
+        m_EntryType = EntryType::Skipped;
+        return;
+    }
+
+    m_File = file;
+    m_Current = ExtractedFile{ filePath, size, false };
+}
+
+void TarExtractor::WriteFile(std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t written = write(m_File, data.data(), data.size());
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::runtime_error("Couldn't write " + m_Current.m_Path.string() + ": " + strerror(errno));
+        }
+
+        data.remove_prefix((size_t)written);
+    }
+}
+
+void TarExtractor::CloseFile()
+{
+#ifdef __linux__
+    /* Starts writing the file back, so that syncing the batch mostly finds
+       it done already. */
+    sync_file_range(m_File, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+
+    m_UnsyncedFiles.push_back(std::exchange(m_File, -1));
+    m_Files.push_back(std::move(m_Current));
+
+    if (m_UnsyncedFiles.size() >= MaxUnsyncedFiles)
+    {
+        SyncFiles();
+    }
+}
+
+void TarExtractor::SyncFiles()
+{
+    bool synced = true;
+    for (int file : m_UnsyncedFiles)
+    {
+#ifdef __linux__
+        synced = fdatasync(file) == 0 && synced;
+#else
+        synced = fsync(file) == 0 && synced;
+#endif
+        close(file);
+    }
+
+    m_UnsyncedFiles.clear();
+
+    if (!synced)
+    {
+        throw std::runtime_error("Couldn't sync the files extracted to " + m_Directory.string() + ": " +
+                                 strerror(errno));
+    }
+}
+#endif
+
+void TarExtractor::ParsePax()
+{
+    std::string_view records = m_Metadata;
+
+    /* Records are "<length> <key>=<value>\n", the length counts all of
+       it. */
+    while (!records.empty())
+    {
+        size_t length = 0;
+        auto result = std::from_chars(records.data(), records.data() + records.size(), length);
+        size_t space = (size_t)(result.ptr - records.data());
+
+        if (result.ec != std::errc() || length <= space + 1 || length > records.size() ||
+            records[space] != ' ' || records[length - 1] != '\n')
+        {
+            throw std::runtime_error("Invalid pax header in an archive");
+        }
+
+        std::string_view record = records.substr(space + 1, length - space - 2);
+        records.remove_prefix(length);
+
+        size_t equals = record.find('=');
+        if (equals == std::string_view::npos)
+        {
+            throw std::runtime_error("Invalid pax header in an archive");
+        }
+
+        std::string_view key = record.substr(0, equals);
+        std::string_view value = record.substr(equals + 1);
+
+        if (key == "path")
+        {
+            m_NextName = value;
+        }
+        else if (key == "size")
+        {
+            auto sizeResult = std::from_chars(value.data(), value.data() + value.size(), m_NextSize);
+            if (sizeResult.ec != std::errc() || sizeResult.ptr != value.data() + value.size())
+            {
+                throw std::runtime_error("Invalid pax header in an archive");
+            }
+        }
+    }
+}
+
+void TarExtractor::ParseHeader()
+{
+    if (std::all_of(m_Header.begin(), m_Header.end(), [](char byte) { return byte == '\0'; }))
+    {
+        m_State = State::End;
+        return;
+    }
+
+    if (!IsChecksumValid(m_Header))
+    {
+        throw std::runtime_error("Invalid archive header checksum");
+    }
+
+    std::string name(GetField(m_Header, 0, 100));
+
+    std::string_view prefix = GetField(m_Header, 345, 155);
+    if (GetField(m_Header, 257, 6).starts_with("ustar") && !prefix.empty())
+    {
+        name = std::string(prefix) + "/" + name;
+    }
+
+    size_t size = ParseNumber(m_Header, 124, 12);
+    char type = m_Header[156];
+
+    if (type == 'L')
+    {
+        m_EntryType = EntryType::LongName;
+    }
+    else if (type == 'x')
+    {
+        m_EntryType = EntryType::Pax;
+    }
+    else
+    {
+        /* The metadata entries before this one apply to it. */
+        if (!m_NextName.empty())
+        {
+            name = m_NextName;
+        }
+
+        if (m_NextSize != (size_t)-1)
+        {
+            size = m_NextSize;
+        }
+
+        m_NextName.clear();
+        m_NextSize = (size_t)-1;
+
+        m_EntryType = EntryType::Skipped;
+
+        /* Only the file name is kept, like for single uploads. */
+        std::string fileName = path(name).filename().string();
+        bool regularFile = type == '0' || type == '\0' || type == '7';
+
+        if (regularFile && !fileName.empty() && fileName != "." && fileName != "..")
+        {
+            m_EntryType = EntryType::File;
+            OpenFile(fileName, size);
+        }
+    }
+
+    m_Left = size;
+    m_PaddingLeft = (BlockSize - size % BlockSize) % BlockSize;
+    m_State = State::Data;
+
+    if (m_Left == 0)
+    {
+        FinishEntry();
+    }
+}
+
+void TarExtractor::FinishEntry()
+{
+    switch (m_EntryType)
+    {
+    case EntryType::File:
+        CloseFile();
+        break;
+    case EntryType::LongName:
+        m_NextName = m_Metadata.substr(0, m_Metadata.find('\0'));
+        break;
+    case EntryType::Pax:
+        ParsePax();
+        break;
+    case EntryType::Skipped:
+        break;
+    }
+
+    m_Metadata.clear();
+    m_State = m_PaddingLeft > 0 ? State::Padding : State::Header;
+}
+
+void TarExtractor::Feed(std::string_view data)
+{
+    while (!data.empty())
+    {
+        switch (m_State)
+        {
+        case State::Header:
+        {
+            size_t part = std::min(BlockSize - m_Header.size(), data.size());
+            m_Header.append(data.substr(0, part));
+            data.remove_prefix(part);
+
+            if (m_Header.size() == BlockSize)
+            {
+                ParseHeader();
+                m_Header.clear();
+            }
+            break;
+        }
+        case State::Data:
+        {
+            std::string_view part = data.substr(0, std::min(m_Left, data.size()));
+
+            if (m_EntryType == EntryType::File)
+            {
+                WriteFile(part);
+            }
+            else if (m_EntryType != EntryType::Skipped)
+            {
+                if (m_Metadata.size() + part.size() > MaxMetadataSize)
+                {
+                    throw std::runtime_error("Archive metadata too large");
+                }
+
+                m_Metadata.append(part);
+            }
+
+            m_Left -= part.size();
+            data.remove_prefix(part.size());
+
+            if (m_Left == 0)
+            {
+                FinishEntry();
+            }
+            break;
+        }
+        case State::Padding:
+        {
+            size_t part = std::min(m_PaddingLeft, data.size());
+            m_PaddingLeft -= part;
+            data.remove_prefix(part);
+
+            if (m_PaddingLeft == 0)
+            {
+                m_State = State::Header;
+            }
+            break;
+        }
+        case State::End:
+            /* The second end block, and whatever pads the archive. */
+            return;
+        }
+    }
+}
+
+void TarExtractor::Finish()
+{
+    /* The end blocks are optional to some archivers, an archive that stops
+       between entries is complete too. */
+    if (m_State != State::End && (m_State != State::Header || !m_Header.empty()))
+    {
+        throw std::runtime_error("The archive is truncated");
+    }
+
+#ifndef _WIN32
+    /* Only the files of this archive, syncing the whole filesystem would
+       wait for the writes of every other upload as well. */
+    SyncFiles();
+
+    if (fsync(m_DirectoryDescriptor) != 0)
+    {
+        throw std::runtime_error("Couldn't sync " + m_Directory.string() + ": " + strerror(errno));
+    }
+#endif
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <string_view>
+#include <filesystem>
+
+/* Extracts the regular files of a tar archive into a directory while the
+   archive is received, so only a block of it is in memory at a time. Files
+   are placed under their file name only, like single uploads, and existing
+   ones are left alone. ustar, GNU long names and pax paths and sizes are
+   understood, other entries are skipped.
+
+   The directory is opened once and every file is created relative to it.
+   Files are synced in batches, waiting for a whole batch at once, and the
+   directory once by Finish. */
+class TarExtractor
+{
+public:
+    struct ExtractedFile
+    {
+        std::filesystem::path m_Path;
+        size_t m_Size;
+        bool m_Existed;
+    };
+
+private:
+    enum class State
+    {
+        Header,
+        Data,
+        Padding,
+        End
+    };
+
+    enum class EntryType
+    {
+        File,
+        LongName,
+        Pax,
+        Skipped
+    };
+
+    std::filesystem::path m_Directory;
+#ifdef _WIN32
+    void* m_File;
+#else
+    int m_DirectoryDescriptor;
+    int m_File = -1;
+
+    /* Files written completely but not synced yet, kept open until the
+       batch is synced. */
+    std::vector<int> m_UnsyncedFiles;
+
+    void SyncFiles();
+#endif
+
+    State m_State = State::Header;
+    std::string m_Header;
+    EntryType m_EntryType = EntryType::Skipped;
+    size_t m_Left = 0;
+    size_t m_PaddingLeft = 0;
+
+    /* Contents of long name and pax entries, which apply to the next
+       entry. */
+    std::string m_Metadata;
+    std::string m_NextName;
+    size_t m_NextSize = (size_t)-1;
+
+    /* Only listed once it is complete. */
+    ExtractedFile m_Current;
+    std::vector<ExtractedFile> m_Files;
+
+    void ParseHeader();
+    void ParsePax();
+
+    void OpenFile(const std::string& name, size_t size);
+    void WriteFile(std::string_view data);
+    void CloseFile();
+
+    void FinishEntry();
+
+public:
+    TarExtractor(const std::filesystem::path& directory);
+
+    TarExtractor(const TarExtractor&) = delete;
+    TarExtractor& operator=(const TarExtractor&) = delete;
+
+    /* A file left incomplete is deleted. */
+    ~TarExtractor();
+
+    /* Takes the next part of the archive, of any size. */
+    void Feed(std::string_view data);
+
+    /* Throws unless the archive is complete, then syncs what was
+       extracted. */
+    void Finish();
+
+    /* Files skipped or extracted completely so far, also after a
+       failure. */
+    const std::vector<ExtractedFile>& GetFiles() const
+    {
+        return m_Files;
+    }
+};
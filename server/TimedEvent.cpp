@@ -1,110 +1,332 @@
 #include "TimedEvent.hpp"
 
+#include <array>
+#include <thread>
 #include <iostream>
+#include <condition_variable>
 
 namespace Timed
 {
-    std::thread TimedEvent::CleanupThread;
-    std::mutex TimedEvent::Mutex;
-    std::condition_variable TimedEvent::ConditionVariable;
-    std::set<TimedEvent*> TimedEvent::Events;
+    constexpr auto TickDuration = std::chrono::milliseconds(10);
 
-    static std::atomic<bool> Initialized;
+    /* Each level has 256 slots, a slot of a level covers all the slots of
+       the level below. With 10 ms ticks, four levels reach about 500 days,
+       later events are cascaded down again until they are due. */
+    constexpr size_t SlotBits = 8;
+    constexpr size_t SlotCount = 1 << SlotBits;
+    constexpr size_t LevelCount = 4;
 
-    TimedEvent::TimedEvent(ExpirationDate expitationDate, decltype(m_Callback) callback) :
-        m_ExpirationDate(expitationDate), m_Callback(callback)
-    {
-        bool expected = false;
+    constexpr size_t ShardCount = 16;
 
-        if (Initialized.compare_exchange_strong(expected, true) == true)
-        {
-            std::cout << "Initializing the TimedEvent cleanup thread\n";
+    static const TimedEvent::Clock::time_point Epoch = TimedEvent::Clock::now();
 
-            CleanupThread = std::thread(TimedEvent::CleanupThreadRoutine);
-            CleanupThread.detach();
+    static uint64_t ToTick(TimedEvent::ExpirationDate date)
+    {
+        if (date <= Epoch)
+        {
+            return 0;
         }
+
+        /* Rounded up, events never expire early. */
+        return (uint64_t)((date - Epoch + TickDuration - std::chrono::nanoseconds(1)) / TickDuration);
     }
 
-    TimedEvent::~TimedEvent()
+    /* The dispatcher thread is never stopped, so what it uses is never
+       destroyed. */
+    static std::mutex& DispatcherMutex = *new std::mutex;
+    static std::condition_variable& DispatcherWakeup = *new std::condition_variable;
+    static std::atomic<size_t> ScheduledEvents = 0;
+    static std::thread::id DispatcherThread;
+
+    class TimerShard
     {
-        std::lock_guard lock(Mutex);
+    private:
+        std::mutex m_Mutex;
+        std::condition_variable m_CallbackReturned;
 
-        auto it = Events.find(this);
-        if (it != Events.end())
+        /* Event whose callback is running, cleared if the event is destroyed
+           by its own callback. */
+        TimedEvent* m_Running = nullptr;
+
+        uint64_t m_CurrentTick = 0;
+        size_t m_WheelEvents = 0;
+        std::array<std::array<TimedEvent*, SlotCount>, LevelCount> m_Slots = {};
+        TimedEvent* m_Expired = nullptr;
+
+        static void Link(TimedEvent*& head, TimedEvent* event)
         {
-            Events.erase(it);
+            event->m_Next = head;
+            if (head != nullptr)
+            {
+                head->m_Link = &event->m_Next;
+            }
+
+            head = event;
+            event->m_Link = &head;
         }
-    }
 
-    void TimedEvent::AddEvent()
-    {
-        std::unique_lock lock(Mutex);
+        static void Unlink(TimedEvent* event)
+        {
+            *event->m_Link = event->m_Next;
+            if (event->m_Next != nullptr)
+            {
+                event->m_Next->m_Link = event->m_Link;
+            }
 
-        Events.insert(this);
-        lock.unlock();
+            event->m_Next = nullptr;
+            event->m_Link = nullptr;
+        }
 
-        /* Wake the cleanup thread in case this event is now the first one to
-           expire. */
-        ConditionVariable.notify_all();
-    }
+        /* The slot of the current tick is only still to come while
+           cascading. */
+        void Place(TimedEvent* event, uint64_t earliestTick)
+        {
+            uint64_t tick = std::max(ToTick(event->m_ExpirationDate), earliestTick);
+            uint64_t delta = tick - m_CurrentTick;
 
-    bool TimedEvent::Cancel()
-    {
-        /* Busy block until the callback returns */
-        while (this->m_CallbackRunning)
+            size_t level = 0;
+            while (level < LevelCount - 1 && delta >= (1ull << (SlotBits * (level + 1))))
+            {
+                level++;
+            }
+
+            if (delta >= (1ull << (SlotBits * LevelCount)))
+            {
+                tick = m_CurrentTick + (1ull << (SlotBits * LevelCount)) - 1;
+            }
+
+            size_t slot = (tick >> (SlotBits * level)) & (SlotCount - 1);
+            Link(m_Slots[level][slot], event);
+        }
+
+        /* Removes the event from the wheel or from the expired list. */
+        bool Remove(TimedEvent* event)
         {
-            std::this_thread::yield();
+            if (event->m_State == TimedEvent::State::Scheduled)
+            {
+                m_WheelEvents--;
+            }
+            else if (event->m_State != TimedEvent::State::Expired)
+            {
+                return false;
+            }
+
+            Unlink(event);
+            event->m_State = TimedEvent::State::Idle;
+            ScheduledEvents--;
+            return true;
         }
 
-        std::lock_guard lock(Mutex);
+        void Cascade(size_t level)
+        {
+            size_t slot = (m_CurrentTick >> (SlotBits * level)) & (SlotCount - 1);
+            TimedEvent* event = m_Slots[level][slot];
+            m_Slots[level][slot] = nullptr;
 
-        auto it = Events.find(this);
-        if (it == Events.end())
+            while (event != nullptr)
+            {
+                TimedEvent* next = event->m_Next;
+                Place(event, m_CurrentTick);
+                event = next;
+            }
+        }
+
+        /* Advances the wheel and moves every event that became due to the
+           expired list. */
+        void Advance(uint64_t targetTick)
         {
-            return false;
+            while (m_CurrentTick < targetTick)
+            {
+                /* Nothing to cascade or expire in an empty wheel. */
+                if (m_WheelEvents == 0)
+                {
+                    m_CurrentTick = targetTick;
+                    return;
+                }
+
+                m_CurrentTick++;
+
+                /* Higher levels first, what they cascade may land in the
+                   slot of a lower level that is cascaded next. */
+                size_t levels = 0;
+                while (levels < LevelCount - 1 &&
+                       (m_CurrentTick & ((1ull << (SlotBits * (levels + 1))) - 1)) == 0)
+                {
+                    levels++;
+                }
+
+                for (size_t level = levels; level > 0; level--)
+                {
+                    Cascade(level);
+                }
+
+                TimedEvent*& slot = m_Slots[0][m_CurrentTick & (SlotCount - 1)];
+                while (slot != nullptr)
+                {
+                    TimedEvent* event = slot;
+                    Unlink(event);
+                    Link(m_Expired, event);
+
+                    event->m_State = TimedEvent::State::Expired;
+                    m_WheelEvents--;
+                }
+            }
         }
 
-        Events.erase(it);
-        return true;
-    }
+    public:
+        void Add(TimedEvent* event)
+        {
+            std::unique_lock lock(m_Mutex);
 
-    TimedEvent::ExpirationDate TimedEvent::GetNextTimeout()
-    {
-        /* If there are no events to check, wait one minute. */
-        if (Events.size() == 0)
+            Remove(event);
+
+            Place(event, m_CurrentTick + 1);
+            event->m_State = TimedEvent::State::Scheduled;
+            m_WheelEvents++;
+
+            /* The dispatcher only sleeps while there are no events. */
+            bool wakeDispatcher = ScheduledEvents++ == 0;
+            lock.unlock();
+
+            if (wakeDispatcher)
+            {
+                std::lock_guard guard(DispatcherMutex);
+                DispatcherWakeup.notify_one();
+            }
+        }
+
+        bool Cancel(TimedEvent* event, bool destroying)
         {
-            return std::chrono::file_clock::now() + std::chrono::minutes(1);
+            std::unique_lock lock(m_Mutex);
+
+            bool removed = Remove(event);
+
+            if (m_Running == event)
+            {
+                /* From its own callback, the dispatcher mustn't touch the
+                   event afterwards if it is being destroyed. */
+                if (std::this_thread::get_id() == DispatcherThread)
+                {
+                    if (destroying)
+                    {
+                        m_Running = nullptr;
+                    }
+                }
+                else
+                {
+                    m_CallbackReturned.wait(lock,
+                        [&]()
+                        {
+                            return m_Running != event;
+                        });
+                }
+            }
+
+            return removed;
+        }
+
+        /* Runs the callbacks of the events expired until the tick. */
+        void Expire(uint64_t targetTick)
+        {
+            std::unique_lock lock(m_Mutex);
+            Advance(targetTick);
+
+            while (m_Expired != nullptr)
+            {
+                TimedEvent* event = m_Expired;
+                Unlink(event);
+                ScheduledEvents--;
+
+                event->m_State = TimedEvent::State::Running;
+                m_Running = event;
+
+                /* A copy, the callback may destroy the event. */
+                auto callback = event->m_Callback;
+                lock.unlock();
+
+                callback();
+
+                lock.lock();
+
+                /* Unless it was added again by the callback. */
+                if (m_Running == event)
+                {
+                    if (event->m_State == TimedEvent::State::Running)
+                    {
+                        event->m_State = TimedEvent::State::Idle;
+                    }
+                    m_Running = nullptr;
+                }
+                m_CallbackReturned.notify_all();
+            }
         }
+    };
 
-        return (*Events.begin())->m_ExpirationDate;
+    static std::array<TimerShard, ShardCount>& Shards = *new std::array<TimerShard, ShardCount>;
+
+    static TimerShard& GetLocalShard()
+    {
+        static std::atomic<size_t> NextShard = 0;
+        thread_local size_t ShardIndex = NextShard++ % ShardCount;
+
+        return Shards[ShardIndex];
     }
 
-    void TimedEvent::CleanupThreadRoutine()
+    static void DispatcherThreadRoutine()
     {
+        auto nextTick = TimedEvent::Clock::now();
+
         while (true)
         {
-            std::unique_lock lock(Mutex);
+            {
+                std::unique_lock lock(DispatcherMutex);
+                DispatcherWakeup.wait(lock,
+                    []()
+                    {
+                        return ScheduledEvents > 0;
+                    });
+            }
 
-            /* Wait until the next timeout expires, or until a new event is
-               added to the queue. */
-            ConditionVariable.wait_until(lock,
-                                         GetNextTimeout());
+            nextTick = std::max(nextTick + TickDuration, TimedEvent::Clock::now());
+            std::this_thread::sleep_until(nextTick);
 
-            if (!(*Events.begin())->IsExpired())
+            /* The last tick that has fully passed. */
+            uint64_t tick = (uint64_t)((TimedEvent::Clock::now() - Epoch) / TickDuration);
+            for (auto& shard : Shards)
             {
-                continue;
+                shard.Expire(tick);
             }
+        }
+    }
 
-            auto& event = *Events.begin();
-            Events.erase(Events.begin());
+    TimedEvent::TimedEvent(ExpirationDate expirationDate, decltype(m_Callback) callback) :
+        m_ExpirationDate(expirationDate), m_Callback(callback), m_Shard(GetLocalShard())
+    {
+        static std::once_flag started;
 
-            event->m_CallbackRunning = true;
-            lock.unlock();
-            
-            event->m_Callback();
-            
-            lock.lock();
-            event->m_CallbackRunning = false;
-        }
+        std::call_once(started,
+            []()
+            {
+                std::cout << "Initializing the TimedEvent dispatcher thread\n";
+
+                std::thread dispatcher(DispatcherThreadRoutine);
+                DispatcherThread = dispatcher.get_id();
+                dispatcher.detach();
+            });
+    }
+
+    TimedEvent::~TimedEvent()
+    {
+        m_Shard.Cancel(this, true);
+    }
+
+    void TimedEvent::AddEvent()
+    {
+        m_Shard.Add(this);
+    }
+
+    bool TimedEvent::Cancel()
+    {
+        return m_Shard.Cancel(this, false);
     }
-}
\ No newline at end of file
+}
@@ -1,51 +1,66 @@
 #pragma once
 
-#include <map>
 #include <mutex>
-#include <thread>
+#include <atomic>
 #include <chrono>
 #include <functional>
-#include <condition_variable>
-#include <set>
 
 namespace Timed
 {
+    class TimerShard;
+
+    /* A callback run once its expiration date passes. Events are kept in a
+       hierarchical timing wheel, so adding and cancelling them takes constant
+       time. The wheel is split into shards, events are placed in the shard
+       of the thread that created them. One thread advances all shards and
+       runs the callbacks of every expired event in a batch, outside of the
+       shard locks. */
     struct TimedEvent
     {
-        using ExpirationDate = std::chrono::time_point<std::chrono::file_clock>;
-        
+        using Clock = std::chrono::steady_clock;
+        using ExpirationDate = Clock::time_point;
+
+        /* Only changed while the event isn't added. */
         ExpirationDate m_ExpirationDate;
         std::function<void(void)> m_Callback;
-        std::atomic<bool> m_CallbackRunning = false;
-
-        static std::mutex Mutex;
-        static std::condition_variable ConditionVariable;
-        static std::set<TimedEvent*> Events;
 
-        TimedEvent(ExpirationDate expitationDate, decltype(m_Callback) callback);
+        TimedEvent(ExpirationDate expirationDate, decltype(m_Callback) callback);
 
-        TimedEvent(TimedEvent&& other) = default;
+        TimedEvent(const TimedEvent&) = delete;
+        TimedEvent& operator=(const TimedEvent&) = delete;
 
+        /* Cancels the event. Can be destroyed from its own callback. */
         ~TimedEvent();
 
         bool IsExpired() const
         {
-            return std::chrono::file_clock::now() > m_ExpirationDate;
-        }
-
-        bool operator<(const TimedEvent& other) const
-        {
-            return this->m_ExpirationDate < other.m_ExpirationDate;
+            return Clock::now() >= m_ExpirationDate;
         }
 
         void AddEvent();
 
+        /* Returns false if the event wasn't pending. If its callback is
+           running on another thread, waits until it returns. */
         bool Cancel();
+
     private:
-        static std::thread CleanupThread;
+        friend class TimerShard;
+
+        enum class State
+        {
+            Idle,
+            Scheduled,
+            Expired,
+            Running
+        };
 
-        static ExpirationDate GetNextTimeout();
+        TimerShard& m_Shard;
+        State m_State = State::Idle;
 
-        static void CleanupThreadRoutine();
+        /* Links in a slot of the wheel, or in the list of expired events.
+           m_Link points at the pointer to this event, so it can be unlinked
+           without knowing which list it is in. */
+        TimedEvent* m_Next = nullptr;
+        TimedEvent** m_Link = nullptr;
     };
-}
\ No newline at end of file
+}
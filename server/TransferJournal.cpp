@@ -0,0 +1,449 @@
+#include "TransferJournal.hpp"
+
+#include <thread>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std::filesystem;
+
+/* Written data becomes resumable at most this long after it was received. */
+constexpr auto SyncInterval = std::chrono::seconds(1);
+
+constexpr char JournalMagic[4] = { 'U', 'P', 'T', 'J' };
+constexpr uint32_t JournalVersion = 2;
+
+constexpr size_t HeaderSize = 4096;
+constexpr size_t CopySize = 2048;
+constexpr size_t SlotSize = 2 * CopySize;
+constexpr size_t MaxPathLength = 1024;
+constexpr size_t MaxDigestLength = 72;
+constexpr size_t MaxRanges = 57;
+
+constexpr size_t InitialSlotCount = 64;
+
+struct TransferJournal::Header
+{
+    char m_Magic[4];
+    uint32_t m_Version;
+    uint32_t m_SlotSize;
+};
+
+/* A free slot is one whose newest record has no path. */
+struct TransferJournal::Record
+{
+    uint64_t m_Checksum;
+    uint64_t m_Generation;
+    int64_t m_Expiration;
+    uint64_t m_Size;
+    int32_t m_Id;
+    uint16_t m_PathLength;
+    uint16_t m_RangeCount;
+    char m_Path[MaxPathLength];
+
+    /* Padded with zeros. */
+    char m_ExpectedDigest[MaxDigestLength];
+    uint64_t m_Ranges[MaxRanges][2];
+};
+
+static_assert(sizeof(TransferJournal::Record) <= CopySize);
+
+/* Of everything after the checksum itself. */
+static uint64_t GetChecksum(const TransferJournal::Record& record)
+{
+    const unsigned char* data = (const unsigned char*)&record + sizeof(record.m_Checksum);
+    size_t size = sizeof(record) - sizeof(record.m_Checksum);
+
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static bool IsValid(const TransferJournal::Record& record)
+{
+    return record.m_Generation != 0 &&
+           record.m_PathLength <= MaxPathLength &&
+           record.m_RangeCount <= MaxRanges &&
+           record.m_Checksum == GetChecksum(record);
+}
+
+path TransferJournal::GetPath(const path& uploadDirectory)
+{
+    path directory = absolute(uploadDirectory).lexically_normal();
+    if (!directory.has_filename())
+    {
+        directory = directory.parent_path();
+    }
+
+    return directory.parent_path() / (directory.filename().string() + ".transfers");
+}
+
+TransferJournal::Record& TransferJournal::GetCopy(size_t slot, size_t copy)
+{
+    return *(Record*)(m_Mapping + HeaderSize + slot * SlotSize + copy * CopySize);
+}
+
+#ifdef _WIN32
+TransferJournal::TransferJournal(const path& path)
+{
+    throw std::runtime_error("Upload journals are only supported on POSIX systems");
+}
+
+TransferJournal::~TransferJournal()
+{
+}
+
+void TransferJournal::Map(size_t slotCount)
+{
+}
+
+static void SyncMapping(void* address, size_t size)
+{
+}
+#else
+static void SyncMapping(void* address, size_t size)
+{
+    static const uintptr_t PageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+    uintptr_t begin = (uintptr_t)address & ~(PageSize - 1);
+    uintptr_t end = (uintptr_t)address + size;
+
+    if (msync((void*)begin, end - begin, MS_SYNC) != 0)
+    {
+        std::cerr << "[!] Couldn't sync the upload journal: " << strerror(errno) << "\n";
+    }
+}
+
+TransferJournal::TransferJournal(const path& path)
+{
+    m_Descriptor = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_Descriptor < 0)
+    {
+        throw std::runtime_error("Unable to open the upload journal " + path.string());
+    }
+
+    struct stat fileStat;
+    if (fstat(m_Descriptor, &fileStat) != 0)
+    {
+        close(m_Descriptor);
+        throw std::runtime_error("Unable to open the upload journal " + path.string());
+    }
+
+    size_t fileSize = (size_t)fileStat.st_size;
+    Header expected = {};
+    std::memcpy(expected.m_Magic, JournalMagic, sizeof(JournalMagic));
+    expected.m_Version = JournalVersion;
+    expected.m_SlotSize = SlotSize;
+
+    Header header = {};
+    bool compatible =
+        fileSize >= HeaderSize &&
+        pread(m_Descriptor, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        std::memcmp(&header, &expected, sizeof(header)) == 0;
+
+    if (!compatible)
+    {
+        if (fileSize > 0)
+        {
+            std::cerr << "[!] Discarding the incompatible upload journal " << path << "\n";
+        }
+
+        if (ftruncate(m_Descriptor, 0) != 0 ||
+            ftruncate(m_Descriptor, HeaderSize + InitialSlotCount * SlotSize) != 0 ||
+            pwrite(m_Descriptor, &expected, sizeof(expected), 0) != (ssize_t)sizeof(expected) ||
+            fdatasync(m_Descriptor) != 0)
+        {
+            close(m_Descriptor);
+            throw std::runtime_error("Unable to initialize the upload journal " + path.string());
+        }
+
+        fileSize = HeaderSize + InitialSlotCount * SlotSize;
+    }
+
+    try
+    {
+        Map((fileSize - HeaderSize) / SlotSize);
+    }
+    catch (...)
+    {
+        close(m_Descriptor);
+        throw;
+    }
+}
+
+TransferJournal::~TransferJournal()
+{
+    if (m_Mapping != nullptr)
+    {
+        munmap(m_Mapping, HeaderSize + m_SlotCount * SlotSize);
+    }
+
+    close(m_Descriptor);
+}
+
+void TransferJournal::Map(size_t slotCount)
+{
+    if (m_Mapping != nullptr)
+    {
+        munmap(m_Mapping, HeaderSize + m_SlotCount * SlotSize);
+        m_Mapping = nullptr;
+    }
+
+    void* address = mmap(nullptr, HeaderSize + slotCount * SlotSize,
+                         PROT_READ | PROT_WRITE, MAP_SHARED, m_Descriptor, 0);
+    if (address == MAP_FAILED)
+    {
+        throw std::runtime_error("Unable to map the upload journal");
+    }
+
+    m_Mapping = (char*)address;
+    m_SlotCount = slotCount;
+}
+#endif
+
+/* The new slots read as zeros, which is a slot that was never written. */
+void TransferJournal::Grow()
+{
+    size_t slotCount = m_SlotCount * 2;
+
+#ifndef _WIN32
+    if (ftruncate(m_Descriptor, (off_t)(HeaderSize + slotCount * SlotSize)) != 0)
+    {
+        throw std::runtime_error("Unable to grow the upload journal");
+    }
+#endif
+
+    Map(slotCount);
+
+    for (size_t slot = slotCount; slot > m_Generations.size(); slot--)
+    {
+        m_FreeSlots.push_back(slot - 1);
+    }
+
+    m_Generations.resize(slotCount, 0);
+}
+
+void TransferJournal::WriteRecord(size_t slot, const OngoingFileTransfer* transfer, const RangeSet& ranges)
+{
+    Record record = {};
+    record.m_Generation = m_Generations[slot] + 1;
+
+    if (transfer != nullptr)
+    {
+        std::string path = transfer->m_Path.string();
+
+        record.m_Id = transfer->m_Id;
+        record.m_Size = transfer->m_SizeTotal;
+        record.m_Expiration = std::chrono::duration_cast<std::chrono::seconds>(
+            transfer->m_Expiration.time_since_epoch()).count();
+        record.m_PathLength = (uint16_t)path.size();
+        std::memcpy(record.m_Path, path.data(), path.size());
+        std::memcpy(record.m_ExpectedDigest, transfer->m_ExpectedDigest.data(),
+                    std::min(transfer->m_ExpectedDigest.size(), MaxDigestLength));
+
+        for (auto [begin, end] : ranges.GetRanges())
+        {
+            if (record.m_RangeCount == MaxRanges)
+            {
+                break;
+            }
+
+            record.m_Ranges[record.m_RangeCount][0] = begin;
+            record.m_Ranges[record.m_RangeCount][1] = end;
+            record.m_RangeCount++;
+        }
+    }
+
+    record.m_Checksum = GetChecksum(record);
+
+    Record& copy = GetCopy(slot, record.m_Generation % 2);
+    std::memcpy(&copy, &record, sizeof(record));
+    SyncMapping(&copy, sizeof(record));
+
+    m_Generations[slot] = record.m_Generation;
+}
+
+std::vector<TransferJournal::RestoredTransfer> TransferJournal::Restore()
+{
+    std::lock_guard guard(m_Mutex);
+
+    std::vector<RestoredTransfer> transfers;
+    m_Generations.assign(m_SlotCount, 0);
+
+    for (size_t slot = 0; slot < m_SlotCount; slot++)
+    {
+        const Record* newest = nullptr;
+
+        for (size_t copy = 0; copy < 2; copy++)
+        {
+            const Record& record = GetCopy(slot, copy);
+            if (IsValid(record) && (newest == nullptr || record.m_Generation > newest->m_Generation))
+            {
+                newest = &record;
+            }
+        }
+
+        if (newest == nullptr || newest->m_PathLength == 0)
+        {
+            if (newest != nullptr)
+            {
+                m_Generations[slot] = newest->m_Generation;
+            }
+            continue;
+        }
+
+        m_Generations[slot] = newest->m_Generation;
+
+        RestoredTransfer transfer;
+        transfer.m_Id = newest->m_Id;
+        transfer.m_Path = path(std::string(newest->m_Path, newest->m_PathLength));
+        transfer.m_Size = newest->m_Size;
+        transfer.m_Expiration = std::chrono::system_clock::time_point(std::chrono::seconds(newest->m_Expiration));
+        transfer.m_ExpectedDigest = std::string(newest->m_ExpectedDigest,
+                                                strnlen(newest->m_ExpectedDigest, MaxDigestLength));
+        transfer.m_Slot = slot;
+
+        for (size_t i = 0; i < newest->m_RangeCount; i++)
+        {
+            transfer.m_Received.Add(newest->m_Ranges[i][0], newest->m_Ranges[i][1]);
+        }
+
+        transfers.push_back(std::move(transfer));
+    }
+
+    for (size_t slot = m_SlotCount; slot > 0; slot--)
+    {
+        if (m_Generations[slot - 1] == 0 || GetCopy(slot - 1, m_Generations[slot - 1] % 2).m_PathLength == 0)
+        {
+            m_FreeSlots.push_back(slot - 1);
+        }
+    }
+
+    std::thread(&TransferJournal::SyncThreadRoutine, this).detach();
+    return transfers;
+}
+
+void TransferJournal::Release(size_t slot)
+{
+    std::lock_guard guard(m_Mutex);
+
+    WriteRecord(slot, nullptr, RangeSet());
+    m_FreeSlots.push_back(slot);
+}
+
+void TransferJournal::Add(OngoingFileTransfer& transfer)
+{
+    if (transfer.m_Path.string().size() > MaxPathLength)
+    {
+        std::cerr << "[!] The path of " << transfer.m_Path << " is too long to be resumable\n";
+        return;
+    }
+
+    std::lock_guard guard(m_Mutex);
+
+    if (m_FreeSlots.empty())
+    {
+        Grow();
+    }
+
+    size_t slot = m_FreeSlots.back();
+    m_FreeSlots.pop_back();
+
+    WriteRecord(slot, &transfer, RangeSet());
+    transfer.m_JournalSlot = slot;
+}
+
+void TransferJournal::Remove(OngoingFileTransfer& transfer)
+{
+    std::lock_guard guard(m_Mutex);
+
+    if (transfer.m_JournalSlot == NoJournalSlot)
+    {
+        return;
+    }
+
+    WriteRecord(transfer.m_JournalSlot, nullptr, RangeSet());
+    m_FreeSlots.push_back(transfer.m_JournalSlot);
+    transfer.m_JournalSlot = NoJournalSlot;
+}
+
+void TransferJournal::MarkDirty(OngoingFileTransfer& transfer)
+{
+    if (transfer.m_Dirty.exchange(true))
+    {
+        return;
+    }
+
+    std::lock_guard guard(m_DirtyMutex);
+    m_DirtyTransfers.push_back(transfer.weak_from_this());
+}
+
+/* The journal lives as long as the process, and so does the thread. */
+void TransferJournal::SyncThreadRoutine()
+{
+    std::vector<std::weak_ptr<OngoingFileTransfer>> dirtyTransfers;
+
+    while (true)
+    {
+        std::this_thread::sleep_for(SyncInterval);
+
+        {
+            std::lock_guard guard(m_DirtyMutex);
+            dirtyTransfers.swap(m_DirtyTransfers);
+        }
+
+        for (auto& weakTransfer : dirtyTransfers)
+        {
+            auto transfer = weakTransfer.lock();
+            if (transfer == nullptr)
+            {
+                continue;
+            }
+
+            /* Ranges received after the copy mark the transfer again. */
+            transfer->m_Dirty = false;
+
+            RangeSet received;
+            {
+                std::lock_guard guard(transfer->m_Mutex);
+                received = transfer->m_Received;
+            }
+
+            try
+            {
+                transfer->m_File.Sync();
+            }
+            catch (const std::runtime_error& error)
+            {
+                std::cerr << "[!] " << error.what() << "\n";
+                continue;
+            }
+
+            {
+                std::lock_guard guard(m_Mutex);
+
+                if (transfer->m_JournalSlot != NoJournalSlot)
+                {
+                    WriteRecord(transfer->m_JournalSlot, transfer.get(), received);
+                }
+            }
+
+            std::lock_guard guard(transfer->m_Mutex);
+            transfer->m_Durable = received;
+        }
+
+        dirtyTransfers.clear();
+    }
+}
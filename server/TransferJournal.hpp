@@ -0,0 +1,82 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+#include "FileTransfer.hpp"
+
+/* Keeps the state of the ongoing transfers in a memory-mapped file, so that
+   they can be resumed after a restart. Every transfer has a fixed-size slot
+   with two copies of its record. A record replaces the older copy and is
+   synced before the newer one is given up, so a crash in the middle of a
+   write leaves the previous record intact.
+
+   Ranges are only recorded after the data in them was synced to the disk.
+   Requests just mark their transfer as written, a background thread syncs
+   the written transfers and records their ranges once per interval. */
+class TransferJournal
+{
+public:
+    struct Header;
+    struct Record;
+
+    struct RestoredTransfer
+    {
+        TransferRegistry::TransferId m_Id;
+        std::filesystem::path m_Path;
+        size_t m_Size;
+        std::chrono::system_clock::time_point m_Expiration;
+        std::string m_ExpectedDigest;
+        RangeSet m_Received;
+        size_t m_Slot;
+    };
+
+private:
+    std::mutex m_Mutex;
+    int m_Descriptor = -1;
+    char* m_Mapping = nullptr;
+    size_t m_SlotCount = 0;
+
+    /* Generation of the newest record of each slot, the next record goes to
+       the other copy. */
+    std::vector<uint64_t> m_Generations;
+    std::vector<size_t> m_FreeSlots;
+
+    std::mutex m_DirtyMutex;
+    std::vector<std::weak_ptr<OngoingFileTransfer>> m_DirtyTransfers;
+
+    Record& GetCopy(size_t slot, size_t copy);
+    void Map(size_t slotCount);
+    void Grow();
+
+    /* An empty path frees the slot. */
+    void WriteRecord(size_t slot, const OngoingFileTransfer* transfer, const RangeSet& ranges);
+
+    void SyncThreadRoutine();
+
+public:
+    TransferJournal(const std::filesystem::path& path);
+
+    TransferJournal(const TransferJournal&) = delete;
+    TransferJournal& operator=(const TransferJournal&) = delete;
+
+    ~TransferJournal();
+
+    /* Reads the recorded transfers and starts the background thread. Slots
+       of the transfers that can't be resumed have to be released. */
+    std::vector<RestoredTransfer> Restore();
+
+    void Release(size_t slot);
+
+    /* Records a new transfer, with no ranges received. */
+    void Add(OngoingFileTransfer& transfer);
+
+    void Remove(OngoingFileTransfer& transfer);
+
+    /* The transfer is synced and recorded by the background thread. */
+    void MarkDirty(OngoingFileTransfer& transfer);
+
+    static std::filesystem::path GetPath(const std::filesystem::path& uploadDirectory);
+};
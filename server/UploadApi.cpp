@@ -2,6 +2,7 @@
 
 #include <mutex>
 #include <string>
+#include <charconv>
 #include <vector>
 #include <sstream>
 #include <filesystem>
@@ -10,140 +11,263 @@
 #include <span>
 #include <assert.h>
 #include <queue>
+#include <memory>
 
-#include "TimedEvent.hpp"
+#include "LoginApi.hpp"
 #include "ErrorPage.hpp"
+#include "DiskWriter.hpp"
+#include "ContentStore.hpp"
+#include "FileTransfer.hpp"
+#include "TarExtractor.hpp"
+#include "UploadQuota.hpp"
 
 using namespace std::filesystem;
-using namespace Timed;
 
-struct OngoingFileTransfer;
-
-namespace TransferRegistry
+/* Returns false unless the whole parameter is a number. */
+template<typename T>
+static bool ParseQueryNumber(const Request& request, const std::string& key, T& value)
 {
-    using TransferId = int;
-    std::mutex Mutex;
-    std::map<TransferId, std::unique_ptr<OngoingFileTransfer>> Transfers;
+    auto it = request.m_ResourceId.m_Query.find(key);
+    if (it == request.m_ResourceId.m_Query.end() || it->second.empty())
+    {
+        return false;
+    }
+
+    const std::string& text = it->second[0];
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
 }
 
-struct OngoingFileTransfer
-{
-    // TODO: std::weak_ptr<Session*> m_Session;
-    path m_Path;
-    std::ofstream m_OutStream;
-    std::unique_ptr<TimedEvent> m_Event;
-    const TransferRegistry::TransferId m_Id;
-
-    size_t m_SizeTotal = 0;
-    size_t m_SizeLeft = 0;
-
-    OngoingFileTransfer() = default;
-
-    OngoingFileTransfer(TransferRegistry::TransferId id, path path, size_t sizeTotal) : 
-        m_OutStream(path, std::ios_base::binary),
-        m_SizeTotal(sizeTotal),
-        m_SizeLeft(sizeTotal),
-        m_Id(id),
-        m_Event(std::make_unique<TimedEvent>(
-            std::chrono::file_clock::now() + std::chrono::hours(1),
-            [transfer = this]()
-            {
-                using namespace TransferRegistry;
+/* Bodies smaller than that aren't worth the pipe. */
+constexpr size_t SpliceThreshold = 64 * 1024;
+
+/* An archive is read from the connection in parts of that size. */
+constexpr size_t ArchiveReadSize = 64 * 1024;
+
+/* A spooled chunk is queued for the disk writer in parts of that size. */
+constexpr size_t SpooledPartSize = 1024 * 1024;
 
-                std::lock_guard guard(Mutex);
+/* Larger manifests aren't read back into memory. */
+constexpr size_t MaxManifestSize = 16 * 1024 * 1024;
 
-                auto it = Transfers.find(transfer->m_Id);
-                Transfers.erase(it);
-            }))
+/* Large chunks on plain connections are moved from the socket to the file
+   with splice, others are buffered and go through the disk writer. Chunks
+   that would be refused are left buffered, so that the response isn't sent
+   before their body was read. */
+bool UploadFileApi::StreamsBody(const Request& request) const
+{
+    if (request.m_Method != "POST" ||
+        request.m_BodyLeft < SpliceThreshold ||
+        !request.m_Connection.CanSplice())
     {
-        m_Event->AddEvent();
+        return false;
     }
 
-    void Append(std::string_view data)
+    TransferRegistry::TransferId id;
+    if (!ParseQueryNumber(request, "id", id))
     {
-        size_t writeSize = data.size();
-        if (writeSize > m_SizeLeft)
-        {
-            writeSize = m_SizeLeft;
-        }
-        m_SizeLeft -= writeSize;
+        return false;
+    }
 
-        m_OutStream.write(data.data(), data.size());
+    auto transfer = TransferRegistry::Find(id);
+    if (transfer == nullptr || transfer->GetStatus() != TransferStatus::Pending)
+    {
+        return false;
     }
-};
 
-namespace TransferRegistry 
+    size_t offset;
+    return request.m_ResourceId.m_Query.count("offset") == 0 ||
+           (ParseQueryNumber(request, "offset", offset) && offset <= transfer->m_SizeTotal);
+}
+
+/* A chunk is written at the offset given in the query, so chunks of a file
+   can be sent over several connections at once. Chunks without an offset
+   follow the previous ones. The transfer completes once every byte of the
+   file was received.
+
+   Other methods than POST query the transfer instead: Upload-Offset is
+   where the data that would survive a restart ends, and the body lists all
+   the ranges like that, so an interrupted upload can be resumed.
+   Upload-Status tells whether the transfer finished, Upload-Checksum has
+   the checksums of the file once it did. */
+HttpResponse UploadFileApi::operator()(const Request& request)
 {
-    std::pair<TransferId, OngoingFileTransfer&> AddTransfer(path path, size_t size)
+    TransferRegistry::TransferId id;
+    if (!ParseQueryNumber(request, "id", id))
     {
-        std::scoped_lock lock(Mutex);
+        return ErrorPage(400)(request);
+    }
+
+    /* TODO: return 403 if session is not the owner for this id */
+    auto transfer = TransferRegistry::Find(id);
+    if (transfer == nullptr)
+    {
+        return ErrorPage(403)(request);
+    }
+
+    if (request.m_Method != "POST")
+    {
+        RangeSet ranges = transfer->GetResumableRanges();
 
-        TransferId id;
-        do
+        size_t resumeOffset = 0;
+        std::string body;
+        for (auto [begin, end] : ranges.GetRanges())
         {
-            id = rand();
+            if (begin == 0)
+            {
+                resumeOffset = end;
+            }
+
+            body += std::to_string(begin) + "-" + std::to_string(end) + "\n";
         }
-        while (id == 0 || Transfers.count(id) > 0);
 
-        Transfers.insert(std::make_pair(id, std::make_unique<OngoingFileTransfer>(id, path, size)));
-        return std::pair<TransferId, OngoingFileTransfer&>(id, *Transfers[id]);
+        HttpResponse response(body, 200, "text/plain");
+        response.m_Headers["Upload-Offset"] = std::to_string(resumeOffset);
+        response.m_Headers["Upload-Length"] = std::to_string(transfer->m_SizeTotal);
+
+        std::string checksum;
+        switch (transfer->GetStatus(&checksum))
+        {
+        case TransferStatus::Pending:
+            response.m_Headers["Upload-Status"] = "pending";
+            break;
+        case TransferStatus::Complete:
+            response.m_Headers["Upload-Status"] = "complete";
+            break;
+        case TransferStatus::Mismatch:
+            response.m_Headers["Upload-Status"] = "mismatch";
+            break;
+        case TransferStatus::Failed:
+            response.m_Headers["Upload-Status"] = "failed";
+            break;
+        }
+
+        if (!checksum.empty())
+        {
+            response.m_Headers["Upload-Checksum"] = checksum;
+        }
+
+        return response;
     }
-};
 
-HttpResponse UploadFileApi::operator()(const Request& request)
-{
-    std::scoped_lock<std::mutex> lock(TransferRegistry::Mutex);
+    if (transfer->GetStatus() != TransferStatus::Pending)
+    {
+        return ErrorPage(403)(request);
+    }
 
-    if (request.m_ResourceId.m_Query.count("id") == 0)
+    size_t bodySize = request.m_SpooledBody != nullptr ?
+        request.m_SpooledBody->GetSize() : request.m_Body.size();
+
+    size_t offset;
+    if (request.m_ResourceId.m_Query.count("offset") == 0)
+    {
+        offset = transfer->ReserveAppend(bodySize + request.m_BodyLeft);
+    }
+    else if (!ParseQueryNumber(request, "offset", offset) || offset > transfer->m_SizeTotal)
     {
         return ErrorPage(400)(request);
     }
 
-    int id = std::stoi(request.m_ResourceId.m_Query.at("id")[0]);
-
-    /* TODO: return 403 if session is not the owner for this id */
-    if (TransferRegistry::Transfers.count(id) == 0)
+    /* Written and completed by the disk writer. An empty chunk still has
+       to be queued, it completes an empty file. A spooled chunk is read
+       back in parts, the writer's queue bounds how much of it is in memory
+       at once. What is past the end of the file isn't read at all. */
+    if (request.m_SpooledBody != nullptr)
     {
-        return ErrorPage(403)(request);
+        size_t size = std::min(bodySize, transfer->m_SizeTotal - offset);
+        for (size_t done = 0; done < size; done += SpooledPartSize)
+        {
+            size_t part = std::min(SpooledPartSize, size - done);
+            DiskWriter::Get().Enqueue(transfer, offset + done, request.m_SpooledBody->Read(done, part));
+        }
+    }
+    else if (!request.m_Body.empty() || request.m_BodyLeft == 0)
+    {
+        DiskWriter::Get().Enqueue(transfer, offset, std::string(request.m_Body));
     }
 
-    auto it = TransferRegistry::Transfers.find(id);
-    auto& transfer = *it->second.get();
+    if (request.m_BodyLeft > 0)
+    {
+        size_t spliceOffset = std::min(offset + request.m_Body.size(), transfer->m_SizeTotal);
+        size_t spliceSize = std::min(request.m_BodyLeft, transfer->m_SizeTotal - spliceOffset);
 
-    size_t step = std::min(request.m_Body.size(), transfer.m_SizeLeft);
+        size_t moved = transfer->m_File.Splice(request.m_Connection, spliceOffset, spliceSize);
+        if (moved > 0)
+        {
+            DiskWriter::Get().EnqueueSpliced(transfer, spliceOffset, moved);
+        }
 
-    transfer.m_OutStream.write(request.m_Body.data(), step);
-    transfer.m_SizeLeft -= step;
+        /* Data past the end of the file is dropped, like in buffered
+           chunks. */
+        size_t left = moved < spliceSize ? 0 : request.m_BodyLeft - moved;
+        while (left > 0)
+        {
+            std::string dropped = request.m_Connection.ReceiveString(std::min(left, (size_t)8192));
+            if (dropped.empty())
+            {
+                break;
+            }
 
-    transfer.m_OutStream.flush();
-    if (transfer.m_SizeLeft == 0)
-    {
-        transfer.m_Event->Cancel();
-        TransferRegistry::Transfers.erase(it);
+            left -= dropped.size();
+        }
     }
 
-    /* TODO: error handling */
     return HttpResponse("", 200);
 }
 
+/* Returns the user of the session the request belongs to, or an empty
+   string. */
+static std::string GetUser(const Request& request)
+{
+    auto cookies = request.GetCookies();
+    if (!cookies.contains("sessionId"))
+    {
+        return "";
+    }
+
+    SessionHandle session(cookies.at("sessionId"));
+    if (!session)
+    {
+        return "";
+    }
+
+    return session.ReadProperty("username");
+}
+
+/* The whole manifest is checked against the upload quotas before any of its
+   transfers is created, and refused at once if it doesn't fit. */
 HttpResponse UploadApi::operator()(const Request& request)
 {
-    std::cout << "Invoking upload api with body: " + std::string(request.m_Body) + "\n";
-    std::stringstream stream = std::stringstream(std::string(request.m_Body));
+    std::string body(request.m_Body);
+    if (request.m_SpooledBody != nullptr)
+    {
+        if (request.m_SpooledBody->GetSize() > MaxManifestSize)
+        {
+            return ErrorPage(413)(request);
+        }
+
+        body = request.m_SpooledBody->Read(0, request.m_SpooledBody->GetSize());
+    }
+
+    std::cout << "Invoking upload api with body: " + body + "\n";
+    std::stringstream stream = std::stringstream(body);
     std::string line = "";
 
     struct File 
     {
         path m_Path;
-        int m_Size;
+        size_t m_Size;
+        std::string m_Digest;
+        bool m_Existed;
     };
 
     std::vector<File> files;
+    uint64_t totalSize = 0;
 
-    std::string response;
     while (stream.eof() == false)
     {
-        int size;
+        size_t size = 0;
         std::string name;
 
         std::getline(stream, line);
@@ -163,21 +287,186 @@ HttpResponse UploadApi::operator()(const Request& request)
         }
         std::getline(lineStream, name);
 
+        /* The file may be preceded by the digest it should have, it is
+           deleted if it doesn't. */
+        std::string digest;
+        size_t space = name.find(' ');
+        if (space != std::string::npos && (name.starts_with("crc32c:") || name.starts_with("sha256:")))
+        {
+            if (!ParseDigest(std::string_view(name).substr(0, space), digest))
+            {
+                return ErrorPage(400)(request);
+            }
+
+            name.erase(0, space + 1);
+        }
+
         path filePath = m_ServerUploadDirectory / path(name).filename();
         bool doesExist = exists(filePath);
 
-        TransferRegistry::TransferId id = 0;
+        /* Existing files are left alone, and were counted already. */
         if (!doesExist)
         {
-            id = TransferRegistry::AddTransfer(filePath, size).first;
+            if (size > UINT64_MAX - totalSize)
+            {
+                return ErrorPage(413)(request);
+            }
+
+            totalSize += size;
         }
 
-        response +=
-            std::to_string(id) + std::string(";") +
-            std::to_string(size) + std::string(";") + filePath.string() + 
-            std::string(";") + ("false\0true" + (6 * doesExist)) + "\n";
+        files.push_back(File{ filePath, size, digest, doesExist });
+    }
+
+    std::string user = GetUser(request);
+    if (!UploadQuota::Get().Reserve(user, totalSize))
+    {
+        std::cout << "[!] Refused uploading " << totalSize << " bytes over the quota of '" << user << "'\n";
+        return ErrorPage(413)(request);
+    }
+
+    /* Space reserved for the files that still have to be created. */
+    uint64_t unsettled = totalSize;
+
+    std::string response;
+    try
+    {
+        for (auto& file : files)
+        {
+            bool doesExist = file.m_Existed || exists(file.m_Path);
+            bool linked = false;
+
+            /* Content uploaded before, under any name, doesn't have to be
+               sent again. */
+            if (!doesExist && ContentStore::Get().Link(file.m_Digest, file.m_Size, file.m_Path))
+            {
+                std::cout << "[*] Linked " << file.m_Path << " to the stored content\n";
+                doesExist = true;
+                linked = true;
+            }
+
+            TransferRegistry::TransferId id = 0;
+            if (!doesExist)
+            {
+                id = TransferRegistry::AddTransfer(file.m_Path, file.m_Size, file.m_Digest);
+            }
+
+            if (!file.m_Existed)
+            {
+                /* Created in the meantime by another upload. */
+                if (doesExist && !linked)
+                {
+                    UploadQuota::Get().Release(user, file.m_Size);
+                }
+                else
+                {
+                    UploadQuota::Get().SetOwner(file.m_Path, user);
+                }
+
+                unsettled -= file.m_Size;
+            }
+
+            response +=
+                std::to_string(id) + std::string(";") +
+                std::to_string(file.m_Size) + std::string(";") + file.m_Path.string() + 
+                std::string(";") + ("false\0true" + (6 * doesExist)) + "\n";
+        }
+    }
+    catch (...)
+    {
+        UploadQuota::Get().Release(user, unsettled);
+        throw;
     }
 
     std::cout << "Response: " << response << "\n";
     return HttpResponse(response, 200);
 }
+
+bool UploadArchiveApi::StreamsBody(const Request& request) const
+{
+    return request.m_Method == "POST";
+}
+
+/* Responds with a line per file of the archive, like the manifest
+   response: its size, its path and whether it already existed, in which
+   case it was left as it was. A malformed archive is refused, the files
+   extracted before the error are kept. What is left of a refused archive
+   isn't read, the error page closes the connection.
+
+   The archive can't take more space than its own size, which is reserved
+   in the quotas before anything is extracted. What the extracted files
+   really take is counted once it is done. */
+HttpResponse UploadArchiveApi::operator()(const Request& request)
+{
+    size_t left = request.m_BodyLeft;
+    uint64_t reserved = request.m_Body.size() + request.m_BodyLeft;
+
+    std::string user = GetUser(request);
+    if (!UploadQuota::Get().Reserve(user, reserved))
+    {
+        std::cout << "[!] Refused an archive of " << reserved << " bytes over the quota of '" << user << "'\n";
+        return ErrorPage(413)(request);
+    }
+
+    std::unique_ptr<TarExtractor> extractor;
+
+    /* Extracted files are charged whether the archive was complete or
+       not, they are kept either way. */
+    auto settle = [&]()
+    {
+        UploadQuota::Get().Release(user, reserved);
+
+        if (extractor == nullptr)
+        {
+            return;
+        }
+
+        for (auto& file : extractor->GetFiles())
+        {
+            if (!file.m_Existed)
+            {
+                UploadQuota::Get().Charge(user, file.m_Size);
+                UploadQuota::Get().SetOwner(file.m_Path, user);
+            }
+        }
+    };
+
+    try
+    {
+        extractor = std::make_unique<TarExtractor>(m_ServerUploadDirectory);
+        extractor->Feed(request.m_Body);
+
+        while (left > 0)
+        {
+            std::string data = request.m_Connection.ReceiveString(std::min(left, ArchiveReadSize));
+            if (data.empty())
+            {
+                throw std::runtime_error("The connection closed before the end of the archive");
+            }
+
+            left -= data.size();
+            extractor->Feed(data);
+        }
+
+        extractor->Finish();
+        settle();
+
+        std::string response;
+        for (auto& file : extractor->GetFiles())
+        {
+            response += std::to_string(file.m_Size) + ";" + file.m_Path.string() + ";" +
+                        (file.m_Existed ? "true" : "false") + "\n";
+        }
+
+        std::cout << "[*] Extracted an archive of " << extractor->GetFiles().size() << " files\n";
+        return HttpResponse(response, 200);
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "[!] " << error.what() << "\n";
+    }
+
+    settle();
+
+    return ErrorPage(400)(request);
+}
@@ -22,4 +22,19 @@ struct UploadApi
 struct UploadFileApi
 {
     HttpResponse operator()(const Request& request);
+
+    bool StreamsBody(const Request& request) const;
+};
+
+/* Takes a tar archive as the body and extracts its files into the upload
+   directory while it is received. */
+struct UploadArchiveApi
+{
+    HttpResponse operator()(const Request& request);
+
+    bool StreamsBody(const Request& request) const;
+
+    std::filesystem::path m_ServerUploadDirectory;
+
+    UploadArchiveApi(std::filesystem::path uploadDir) : m_ServerUploadDirectory(uploadDir) { }
 };
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include "UploadQuota.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_set>
+
+using namespace std::filesystem;
+
+constexpr char OwnersMagic[4] = { 'U', 'P', 'Q', 'O' };
+constexpr uint32_t OwnersVersion = 1;
+
+constexpr unsigned MaxScanThreads = 8;
+
+struct OwnersHeader
+{
+    char m_Magic[4];
+    uint32_t m_Version;
+};
+
+/* Followed by the user and the file name. */
+struct OwnerRecord
+{
+    uint16_t m_UserLength;
+    uint16_t m_NameLength;
+};
+
+static path GetOwnersPath(const path& uploadDirectory)
+{
+    path directory = absolute(uploadDirectory).lexically_normal();
+    if (!directory.has_filename())
+    {
+        directory = directory.parent_path();
+    }
+
+    return directory.parent_path() / (directory.filename().string() + ".owners");
+}
+
+static void WriteOwner(std::ostream& output, const std::string& fileName, const std::string& user)
+{
+    OwnerRecord record = { (uint16_t)user.size(), (uint16_t)fileName.size() };
+    output.write((const char*)&record, sizeof(record));
+    output.write(user.data(), user.size());
+    output.write(fileName.data(), fileName.size());
+}
+
+UploadQuota& UploadQuota::Get()
+{
+    static UploadQuota quota;
+    return quota;
+}
+
+void UploadQuota::AppendOwner(const std::string& fileName, const std::string& user)
+{
+    if (!m_OwnersLog.is_open() || fileName.size() > UINT16_MAX || user.size() > UINT16_MAX)
+    {
+        return;
+    }
+
+    WriteOwner(m_OwnersLog, fileName, user);
+    m_OwnersLog.flush();
+
+    if (!m_OwnersLog)
+    {
+        std::cerr << "[!] Couldn't record the owner of " << fileName << "\n";
+        m_OwnersLog.clear();
+    }
+}
+
+void UploadQuota::Load(const path& uploadDirectory)
+{
+    path ownersPath = GetOwnersPath(uploadDirectory);
+
+    std::ifstream input(ownersPath, std::ios::binary);
+    OwnersHeader header = {};
+    if (input.read((char*)&header, sizeof(header)) &&
+        std::memcmp(header.m_Magic, OwnersMagic, sizeof(OwnersMagic)) == 0 &&
+        header.m_Version == OwnersVersion)
+    {
+        /* A record torn by a crash is ignored. */
+        OwnerRecord record;
+        while (input.read((char*)&record, sizeof(record)))
+        {
+            std::string user(record.m_UserLength, '\0');
+            std::string fileName(record.m_NameLength, '\0');
+            if (!input.read(user.data(), user.size()) || !input.read(fileName.data(), fileName.size()))
+            {
+                break;
+            }
+
+            if (user.empty())
+            {
+                m_Owners.erase(fileName);
+            }
+            else
+            {
+                m_Owners[fileName] = user;
+            }
+        }
+    }
+    else if (exists(ownersPath))
+    {
+        std::cerr << "[!] Discarding the incompatible owner log " << ownersPath << "\n";
+    }
+
+    input.close();
+
+    std::vector<directory_entry> entries;
+    for (auto& entry : directory_iterator(uploadDirectory))
+    {
+        entries.push_back(entry);
+    }
+
+    /* Every file takes a stat, which is what makes scanning a large
+       directory slow, so they are spread over threads. */
+    struct Usage
+    {
+        uint64_t m_Total = 0;
+        std::unordered_map<std::string, uint64_t> m_Users;
+        std::vector<std::string> m_Names;
+    };
+
+    unsigned threadCount = std::clamp(std::thread::hardware_concurrency(), 1u, MaxScanThreads);
+    std::vector<Usage> usages(threadCount);
+    std::atomic<size_t> next = 0;
+
+    {
+        std::vector<std::jthread> threads;
+        for (unsigned i = 0; i < threadCount; i++)
+        {
+            threads.emplace_back([&, i]()
+                {
+                    Usage& usage = usages[i];
+
+                    for (size_t index = next++; index < entries.size(); index = next++)
+                    {
+                        std::error_code error;
+                        if (!entries[index].is_regular_file(error))
+                        {
+                            continue;
+                        }
+
+                        uint64_t size = entries[index].file_size(error);
+                        if (error)
+                        {
+                            continue;
+                        }
+
+                        std::string name = entries[index].path().filename().string();
+                        usage.m_Total += size;
+
+                        auto owner = m_Owners.find(name);
+                        if (owner != m_Owners.end())
+                        {
+                            usage.m_Users[owner->second] += size;
+                        }
+
+                        usage.m_Names.push_back(std::move(name));
+                    }
+                });
+        }
+    }
+
+    std::unordered_set<std::string> names;
+    for (auto& usage : usages)
+    {
+        m_GlobalUsage += usage.m_Total;
+
+        for (auto& [user, size] : usage.m_Users)
+        {
+            m_UserUsage[user] += size;
+        }
+
+        names.insert(usage.m_Names.begin(), usage.m_Names.end());
+    }
+
+    /* Owners of the files deleted in the meantime are dropped. */
+    std::erase_if(m_Owners,
+        [&](const auto& owner)
+        {
+            return names.count(owner.first) == 0;
+        });
+
+    /* Replaced at once, a crash leaves either log complete. */
+    path temporaryPath = ownersPath;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        OwnersHeader newHeader = {};
+        std::memcpy(newHeader.m_Magic, OwnersMagic, sizeof(OwnersMagic));
+        newHeader.m_Version = OwnersVersion;
+        output.write((const char*)&newHeader, sizeof(newHeader));
+
+        for (auto& [fileName, user] : m_Owners)
+        {
+            WriteOwner(output, fileName, user);
+        }
+
+        if (!output.flush())
+        {
+            throw std::runtime_error("Unable to write the owner log " + temporaryPath.string());
+        }
+    }
+
+    rename(temporaryPath, ownersPath);
+
+    m_OwnersLog.open(ownersPath, std::ios::binary | std::ios::app);
+    if (!m_OwnersLog)
+    {
+        throw std::runtime_error("Unable to open the owner log " + ownersPath.string());
+    }
+}
+
+void UploadQuota::Enable(const path& uploadDirectory, uint64_t globalLimit, uint64_t userLimit)
+{
+    std::lock_guard guard(m_Mutex);
+
+    auto start = std::chrono::steady_clock::now();
+
+    /* Whatever was reserved before is on the disk now. */
+    m_GlobalUsage = 0;
+    m_UserUsage.clear();
+
+    try
+    {
+        Load(uploadDirectory);
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "[!] " << error.what() << ", upload quotas won't be enforced\n";
+        return;
+    }
+
+    m_GlobalLimit = globalLimit;
+    m_UserLimit = userLimit;
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    std::cout << "[*] Counted " << m_GlobalUsage << " bytes of uploads of " << m_UserUsage.size()
+              << " users in " << duration.count() << " ms\n";
+}
+
+bool UploadQuota::Reserve(const std::string& user, uint64_t size)
+{
+    std::lock_guard guard(m_Mutex);
+
+    if (m_GlobalLimit != 0 && (size > m_GlobalLimit || m_GlobalUsage > m_GlobalLimit - size))
+    {
+        return false;
+    }
+
+    if (!user.empty())
+    {
+        uint64_t& usage = m_UserUsage[user];
+        if (m_UserLimit != 0 && (size > m_UserLimit || usage > m_UserLimit - size))
+        {
+            return false;
+        }
+
+        usage += size;
+    }
+
+    m_GlobalUsage += size;
+    return true;
+}
+
+void UploadQuota::Charge(const std::string& user, uint64_t size)
+{
+    std::lock_guard guard(m_Mutex);
+
+    m_GlobalUsage += size;
+    if (!user.empty())
+    {
+        m_UserUsage[user] += size;
+    }
+}
+
+void UploadQuota::Release(const std::string& user, uint64_t size)
+{
+    std::lock_guard guard(m_Mutex);
+
+    m_GlobalUsage -= std::min(m_GlobalUsage, size);
+
+    auto it = m_UserUsage.find(user);
+    if (it != m_UserUsage.end())
+    {
+        it->second -= std::min(it->second, size);
+    }
+}
+
+void UploadQuota::SetOwner(const path& file, const std::string& user)
+{
+    if (user.empty())
+    {
+        return;
+    }
+
+    std::string fileName = file.filename().string();
+
+    std::lock_guard guard(m_Mutex);
+
+    m_Owners[fileName] = user;
+    AppendOwner(fileName, user);
+}
+
+void UploadQuota::RemoveFile(const path& file, uint64_t size)
+{
+    std::string fileName = file.filename().string();
+    std::string user;
+    {
+        std::lock_guard guard(m_Mutex);
+
+        auto it = m_Owners.find(fileName);
+        if (it != m_Owners.end())
+        {
+            user = std::move(it->second);
+            m_Owners.erase(it);
+            AppendOwner(fileName, "");
+        }
+    }
+
+    Release(user, size);
+}
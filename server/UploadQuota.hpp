@@ -0,0 +1,65 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <fstream>
+#include <filesystem>
+#include <unordered_map>
+
+/* Limits of the upload directory as a whole and of every user in it. */
+constexpr uint64_t GlobalUploadQuota = 100ull * 1024 * 1024 * 1024;
+constexpr uint64_t UserUploadQuota = 10ull * 1024 * 1024 * 1024;
+
+/* Space used in the upload directory, in total and per user, kept up to
+   date as transfers are created, extracted and deleted so that a request
+   is checked against the quotas without looking at the disk. Space is
+   reserved for the whole declared size of a file when its transfer is
+   created.
+
+   Which user a file belongs to is kept in a log next to the upload
+   directory, files without an entry only count towards the total. At
+   startup the directory is scanned on a few threads to count what is
+   really there, and the log is compacted. */
+class UploadQuota
+{
+private:
+    std::mutex m_Mutex;
+    uint64_t m_GlobalLimit = 0;
+    uint64_t m_UserLimit = 0;
+
+    uint64_t m_GlobalUsage = 0;
+    std::unordered_map<std::string, uint64_t> m_UserUsage;
+
+    /* File names mapped to the users they belong to. */
+    std::unordered_map<std::string, std::string> m_Owners;
+    std::ofstream m_OwnersLog;
+
+    UploadQuota() = default;
+
+    /* An empty user forgets the owner of the file. */
+    void AppendOwner(const std::string& fileName, const std::string& user);
+
+    void Load(const std::filesystem::path& uploadDirectory);
+
+public:
+    static UploadQuota& Get();
+
+    /* Counts the usage of the upload directory and enforces the limits
+       from then on, zero for no limit. */
+    void Enable(const std::filesystem::path& uploadDirectory, uint64_t globalLimit, uint64_t userLimit);
+
+    /* Returns false without reserving anything if the size doesn't fit in
+       the quotas. The per-user one doesn't apply to an empty user. */
+    bool Reserve(const std::string& user, uint64_t size);
+
+    /* Counts space that is already used, whatever the quotas. */
+    void Charge(const std::string& user, uint64_t size);
+
+    void Release(const std::string& user, uint64_t size);
+
+    void SetOwner(const std::filesystem::path& file, const std::string& user);
+
+    /* Releases the space of a deleted file from its owner. */
+    void RemoveFile(const std::filesystem::path& file, uint64_t size);
+};
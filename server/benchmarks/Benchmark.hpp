@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <cstdio>
+
+/* Helpers shared by the benchmarks. They are run by hand, on a release
+   build, and print one line per measurement. */
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+/* Runs the function once and returns how long it took, in seconds. */
+template<typename Function>
+double MeasureSeconds(Function&& function)
+{
+    auto start = BenchmarkClock::now();
+    function();
+    return std::chrono::duration<double>(BenchmarkClock::now() - start).count();
+}
+
+inline void Report(const std::string& name, double value, const char* unit)
+{
+    printf("%-48s %14.2f %s\n", name.c_str(), value, unit);
+    fflush(stdout);
+}
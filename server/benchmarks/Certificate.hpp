@@ -0,0 +1,100 @@
+#pragma once
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+#include <filesystem>
+
+#include <unistd.h>
+
+/* A self-signed RSA certificate and its key, written to temporary files
+   for SslContext and deleted again with the object. */
+class TestCertificate
+{
+private:
+    std::filesystem::path m_CertPath;
+    std::filesystem::path m_KeyPath;
+
+public:
+    TestCertificate()
+    {
+        auto directory = std::filesystem::temp_directory_path();
+        std::string prefix = "benchmark-" + std::to_string(getpid());
+        m_CertPath = directory / (prefix + ".crt");
+        m_KeyPath = directory / (prefix + ".key");
+
+        EVP_PKEY* key = nullptr;
+        EVP_PKEY_CTX* keyCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr);
+        if (keyCtx == nullptr ||
+            EVP_PKEY_keygen_init(keyCtx) <= 0 ||
+            EVP_PKEY_CTX_set_rsa_keygen_bits(keyCtx, 2048) <= 0 ||
+            EVP_PKEY_keygen(keyCtx, &key) <= 0)
+        {
+            EVP_PKEY_CTX_free(keyCtx);
+            throw std::runtime_error("Couldn't generate a key");
+        }
+
+        EVP_PKEY_CTX_free(keyCtx);
+
+        X509* cert = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 60 * 60);
+        X509_set_pubkey(cert, key);
+
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+
+        bool written = X509_sign(cert, key, EVP_sha256()) > 0;
+
+        FILE* certFile = fopen(m_CertPath.c_str(), "w");
+        FILE* keyFile = fopen(m_KeyPath.c_str(), "w");
+        written = written && certFile != nullptr && keyFile != nullptr &&
+                  PEM_write_X509(certFile, cert) > 0 &&
+                  PEM_write_PrivateKey(keyFile, key, nullptr, nullptr, 0, nullptr, nullptr) > 0;
+
+        if (certFile != nullptr)
+        {
+            fclose(certFile);
+        }
+
+        if (keyFile != nullptr)
+        {
+            fclose(keyFile);
+        }
+
+        X509_free(cert);
+        EVP_PKEY_free(key);
+
+        if (!written)
+        {
+            throw std::runtime_error("Couldn't write the test certificate");
+        }
+    }
+
+    TestCertificate(const TestCertificate&) = delete;
+    TestCertificate& operator=(const TestCertificate&) = delete;
+
+    ~TestCertificate()
+    {
+        std::error_code error;
+        std::filesystem::remove(m_CertPath, error);
+        std::filesystem::remove(m_KeyPath, error);
+    }
+
+    std::string GetCertPath() const
+    {
+        return m_CertPath.string();
+    }
+
+    std::string GetKeyPath() const
+    {
+        return m_KeyPath.string();
+    }
+};
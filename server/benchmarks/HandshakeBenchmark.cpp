@@ -0,0 +1,110 @@
+#include "Benchmark.hpp"
+#include "Certificate.hpp"
+
+#include "Https.hpp"
+
+#include <thread>
+#include <memory>
+#include <string>
+
+#include <signal.h>
+#include <sys/socket.h>
+
+/* Connects a client that offers the session of its previous connection, as
+   a returning browser does, with session resumption off, with the session
+   cache only and with session tickets. Reports handshakes per second and
+   how many of them were full ones. */
+
+constexpr int Connections = 300;
+
+/* Returns the session the server gave the client, to offer it next time. */
+static SSL_SESSION* Connect(SslContext& context, SSL_CTX* clientCtx, SSL_SESSION* session)
+{
+    int descriptors[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, descriptors) != 0)
+    {
+        throw std::runtime_error("Couldn't create a socket pair");
+    }
+
+    SSL* client = SSL_new(clientCtx);
+    SSL_set_fd(client, descriptors[1]);
+    if (session != nullptr)
+    {
+        SSL_set_session(client, session);
+    }
+
+    SSL_SESSION* newSession = nullptr;
+    std::thread clientThread([&]()
+        {
+            char byte;
+            if (SSL_connect(client) > 0 && SSL_read(client, &byte, 1) == 1)
+            {
+                /* TLS 1.3 tickets arrive after the handshake. */
+                newSession = SSL_get1_session(client);
+            }
+
+            SSL_shutdown(client);
+        });
+
+    {
+        InetSocketWrapper::InetSocket socket(descriptors[0]);
+        SslConnection connection(context, socket);
+        connection.Accept(socket);
+        connection.Write("x");
+    }
+
+    clientThread.join();
+
+    SSL_free(client);
+    close(descriptors[1]);
+
+    return newSession;
+}
+
+static void Measure(const std::string& name, const TestCertificate& certificate, const SslSessionOptions& options)
+{
+    SslContext context(certificate.GetCertPath(), certificate.GetKeyPath(), options);
+
+    SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_session_cache_mode(clientCtx, SSL_SESS_CACHE_CLIENT);
+
+    SSL_SESSION* session = nullptr;
+    double seconds = MeasureSeconds([&]()
+        {
+            for (int i = 0; i < Connections; i++)
+            {
+                SSL_SESSION* newSession = Connect(context, clientCtx, session);
+                SSL_SESSION_free(session);
+                session = newSession;
+            }
+        });
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(clientCtx);
+
+    auto& statistics = context.GetStatistics();
+    Report(name + ": handshakes", Connections / seconds, "/s");
+    Report(name + ": full handshakes", (double)statistics.m_FullHandshakes, "");
+    Report(name + ": resumed handshakes", (double)statistics.m_ResumedHandshakes, "");
+}
+
+int main()
+{
+    /* A client that gave up mustn't end the benchmark. */
+    signal(SIGPIPE, SIG_IGN);
+
+    TestCertificate certificate;
+
+    SslSessionOptions none;
+    none.m_SessionCache = false;
+    none.m_SessionTickets = false;
+    Measure("no resumption", certificate, none);
+
+    SslSessionOptions cache;
+    cache.m_SessionTickets = false;
+    Measure("session cache", certificate, cache);
+
+    Measure("session tickets", certificate, SslSessionOptions());
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "Benchmark.hpp"
+
+#include "Html.hpp"
+
+#include <memory>
+#include <string>
+
+/* Builds a deep and a wide tree of about the same size, then emits them
+   into one buffer and into a sink. Building and emitting should both take
+   about the same time per node and per byte whatever the shape and the
+   size of the tree, instead of growing with the depth or the number of
+   siblings. */
+
+constexpr size_t Depth = 4000;
+constexpr size_t Width = 4000;
+constexpr size_t MinBuildWidth = 10000;
+constexpr size_t MaxBuildWidth = 160000;
+constexpr int Rounds = 50;
+
+static std::unique_ptr<Tag> BuildDeep()
+{
+    auto html = Tag::Html();
+    Tag* current = html->Body();
+
+    for (size_t i = 0; i < Depth; i++)
+    {
+        current = current->Div();
+        current->AddProperty("id", "node" + std::to_string(i));
+        current->AddContent("level " + std::to_string(i));
+    }
+
+    return html;
+}
+
+static std::unique_ptr<Tag> BuildWide(size_t width = Width)
+{
+    auto html = Tag::Html();
+    Tag* body = html->Body();
+
+    for (size_t i = 0; i < width; i++)
+    {
+        Tag* div = body->Div();
+        div->AddProperty("id", "node" + std::to_string(i));
+        div->AddContent("level " + std::to_string(i));
+    }
+
+    return html;
+}
+
+static void Measure(const std::string& shape, Tag& root)
+{
+    size_t bytes = 0;
+    double seconds = MeasureSeconds([&]()
+        {
+            for (int i = 0; i < Rounds; i++)
+            {
+                bytes += root.Emit().size();
+            }
+        });
+
+    Report(shape + ": emit into one buffer", seconds * 1e9 / bytes, "ns/byte");
+
+    size_t streamed = 0;
+    seconds = MeasureSeconds([&]()
+        {
+            for (int i = 0; i < Rounds; i++)
+            {
+                HtmlWriter writer([&](std::string_view chunk) { streamed += chunk.size(); });
+                root.Write(writer);
+                writer.Flush();
+            }
+        });
+
+    Report(shape + ": stream in chunks", seconds * 1e9 / streamed, "ns/byte");
+    Report(shape + ": document size", (double)bytes / Rounds / 1024, "kB");
+}
+
+int main()
+{
+    std::unique_ptr<Tag> deep;
+    double seconds = MeasureSeconds([&]() { deep = BuildDeep(); });
+    Report("deep: build", seconds * 1e9 / Depth, "ns/node");
+
+    std::unique_ptr<Tag> wide;
+    for (size_t width = MinBuildWidth; width <= MaxBuildWidth; width *= 4)
+    {
+        seconds = MeasureSeconds([&]() { wide = BuildWide(width); });
+        Report("wide: build " + std::to_string(width) + " siblings", seconds * 1e9 / width, "ns/node");
+    }
+
+    wide = BuildWide();
+
+    Measure("deep", *deep);
+    Measure("wide", *wide);
+
+    return 0;
+}
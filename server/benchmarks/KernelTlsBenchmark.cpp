@@ -0,0 +1,193 @@
+#include "Benchmark.hpp"
+#include "Certificate.hpp"
+
+#include "Https.hpp"
+
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Sends a file over TLS on loopback, once encrypted in user space the way
+   FileResponder does it without kTLS, and once with SSL_sendfile when the
+   kernel does the encryption. Reports the throughput of both. */
+
+constexpr size_t FileSize = 256 * 1024 * 1024;
+constexpr size_t ChunkSize = 64 * 1024;
+
+static int CreateFile()
+{
+    std::string path = (std::filesystem::temp_directory_path() / "ktls-benchmark-XXXXXX").string();
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+    {
+        throw std::runtime_error("Couldn't create the file to send");
+    }
+
+    unlink(path.c_str());
+
+    std::vector<char> chunk(ChunkSize);
+    for (size_t i = 0; i < chunk.size(); i++)
+    {
+        chunk[i] = (char)rand();
+    }
+
+    for (size_t written = 0; written < FileSize; written += chunk.size())
+    {
+        if (write(fd, chunk.data(), chunk.size()) != (ssize_t)chunk.size())
+        {
+            throw std::runtime_error("Couldn't write the file to send");
+        }
+    }
+
+    return fd;
+}
+
+static int Listen(uint16_t& port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t length = sizeof(address);
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, 1) != 0 ||
+        getsockname(listener, (sockaddr*)&address, &length) != 0)
+    {
+        throw std::runtime_error("Couldn't listen on loopback");
+    }
+
+    port = ntohs(address.sin_port);
+    return listener;
+}
+
+/* Reads everything the server sends, returns the number of bytes. */
+static size_t Receive(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method());
+    SSL* client = SSL_new(clientCtx);
+    SSL_set_fd(client, fd);
+
+    size_t received = 0;
+    if (SSL_connect(client) > 0)
+    {
+        std::vector<char> buffer(ChunkSize);
+        int got;
+        while ((got = SSL_read(client, buffer.data(), (int)buffer.size())) > 0)
+        {
+            received += got;
+        }
+    }
+
+    SSL_free(client);
+    SSL_CTX_free(clientCtx);
+    close(fd);
+
+    return received;
+}
+
+static void Measure(const std::string& name, SslContext& context, int file, bool sendFile)
+{
+    uint16_t port;
+    int listener = Listen(port);
+
+    size_t received = 0;
+    bool kernelTls = false;
+
+    double seconds = MeasureSeconds([&]()
+        {
+            std::thread client([&]() { received = Receive(port); });
+
+            InetSocketWrapper::InetSocket socket(accept(listener, nullptr, nullptr));
+            {
+                SslConnection connection(context, socket);
+                connection.Accept(socket);
+                kernelTls = connection.IsKernelTlsSend();
+
+                if (sendFile && kernelTls)
+                {
+                    connection.SendFile(file, 0, FileSize);
+                }
+                else
+                {
+                    std::string chunk(ChunkSize, '\0');
+                    for (size_t offset = 0; offset < FileSize; offset += ChunkSize)
+                    {
+                        if (pread(file, chunk.data(), ChunkSize, (off_t)offset) != (ssize_t)ChunkSize)
+                        {
+                            break;
+                        }
+
+                        connection.Write(chunk);
+                    }
+                }
+            }
+
+            socket.Close();
+            client.join();
+        });
+
+    close(listener);
+
+    if (sendFile && !kernelTls)
+    {
+        printf("%s: the kernel can't take over the connection, not measured\n", name.c_str());
+        return;
+    }
+
+    if (received != FileSize)
+    {
+        Report(name + ": incomplete, received", (double)received / (1024 * 1024), "MB");
+        return;
+    }
+
+    Report(name, FileSize / seconds / (1024 * 1024), "MB/s");
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    TestCertificate certificate;
+    int file = CreateFile();
+
+    SslContext userSpace(certificate.GetCertPath(), certificate.GetKeyPath());
+    Measure("user-space encryption, write", userSpace, file, false);
+
+    SslContext kernel(certificate.GetCertPath(), certificate.GetKeyPath());
+    if (!kernel.EnableKernelTls())
+    {
+        printf("This OpenSSL build doesn't support kTLS\n");
+    }
+    else
+    {
+        Measure("kernel encryption, SSL_sendfile", kernel, file, true);
+    }
+
+    close(file);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "Benchmark.hpp"
+
+#include "SessionStore.hpp"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Threads look up random sessions and read a property, as every page render
+   does, in the sharded SessionStore and in a map behind one mutex, the way
+   sessions were kept before. Reports lookups per second by thread count. */
+
+constexpr size_t Sessions = 10000;
+constexpr auto Duration = std::chrono::milliseconds(500);
+constexpr unsigned MaxThreads = 16;
+
+/* The single lock every lookup used to take. */
+class GlobalMutexStore
+{
+private:
+    std::mutex m_Mutex;
+    std::map<std::string, std::map<std::string, std::string>> m_Sessions;
+
+public:
+    std::string CreateSession(const std::map<std::string, std::string>& properties)
+    {
+        std::string sessionId = GenerateRandomSessionId();
+
+        std::lock_guard guard(m_Mutex);
+        m_Sessions[sessionId] = properties;
+        return sessionId;
+    }
+
+    std::string ReadProperty(const std::string& sessionId, const std::string& key)
+    {
+        std::lock_guard guard(m_Mutex);
+
+        auto it = m_Sessions.find(sessionId);
+        if (it == m_Sessions.end())
+        {
+            return "";
+        }
+
+        return it->second[key];
+    }
+};
+
+template<typename Lookup>
+static double MeasureLookups(unsigned threadCount, const std::vector<std::string>& sessionIds, Lookup&& lookup)
+{
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> total = 0;
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < threadCount; i++)
+    {
+        threads.emplace_back([&, i]()
+            {
+                std::mt19937 random(i);
+                uint64_t lookups = 0;
+
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    if (lookup(sessionIds[random() % sessionIds.size()]).empty())
+                    {
+                        throw std::runtime_error("Session lost");
+                    }
+
+                    lookups++;
+                }
+
+                total += lookups;
+            });
+    }
+
+    std::this_thread::sleep_for(Duration);
+    stop = true;
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    return total / std::chrono::duration<double>(Duration).count();
+}
+
+int main()
+{
+    GlobalMutexStore globalStore;
+    std::vector<std::string> sessionIds;
+    std::vector<std::string> globalIds;
+
+    for (size_t i = 0; i < Sessions; i++)
+    {
+        std::map<std::string, std::string> properties = { { "username", "user" + std::to_string(i) } };
+        sessionIds.push_back(SessionStore::Get().CreateSession(properties));
+        globalIds.push_back(globalStore.CreateSession(properties));
+    }
+
+    for (unsigned threads = 1; threads <= MaxThreads; threads *= 2)
+    {
+        double sharded = MeasureLookups(threads, sessionIds,
+            [](const std::string& sessionId)
+            {
+                auto session = SessionStore::Get().OpenSession(sessionId);
+                return session != nullptr ? session->ReadProperty("username") : "";
+            });
+
+        double global = MeasureLookups(threads, globalIds,
+            [&](const std::string& sessionId)
+            {
+                return globalStore.ReadProperty(sessionId, "username");
+            });
+
+        Report("sharded store, " + std::to_string(threads) + " threads", sharded, "lookups/s");
+        Report("global mutex, " + std::to_string(threads) + " threads", global, "lookups/s");
+    }
+
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "Benchmark.hpp"
+
+#include "SessionStore.hpp"
+#include "SessionToken.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/* Opens sessions and reads a property, once by verifying signed tokens and
+   once by looking them up in the SessionStore. Reports the time per
+   session opened on one thread. */
+
+constexpr size_t Sessions = 10000;
+constexpr int Rounds = 50;
+
+static double MeasureOpen(SessionBackend& backend, const std::vector<std::string>& sessionIds)
+{
+    size_t opened = 0;
+    double seconds = MeasureSeconds([&]()
+        {
+            for (int round = 0; round < Rounds; round++)
+            {
+                for (auto& sessionId : sessionIds)
+                {
+                    auto session = backend.OpenSession(sessionId);
+                    if (session == nullptr || session->ReadProperty("username").empty())
+                    {
+                        throw std::runtime_error("Session lost");
+                    }
+
+                    opened++;
+                }
+            }
+        });
+
+    return seconds * 1e9 / opened;
+}
+
+int main()
+{
+    SessionTokens tokens("benchmark secret");
+    SessionStore& store = SessionStore::Get();
+
+    std::vector<std::string> tokenIds;
+    std::vector<std::string> storeIds;
+
+    for (size_t i = 0; i < Sessions; i++)
+    {
+        std::map<std::string, std::string> properties = { { "username", "user" + std::to_string(i) } };
+        tokenIds.push_back(tokens.CreateSession(properties));
+        storeIds.push_back(store.CreateSession(properties));
+    }
+
+    Report("signed token, verify", MeasureOpen(tokens, tokenIds), "ns/session");
+    Report("session store, look up", MeasureOpen(store, storeIds), "ns/session");
+    Report("signed token size", (double)tokenIds.front().size(), "bytes");
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "Benchmark.hpp"
+
+#include "Connection.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Receives an upload body over a loopback connection into a file, once read
+   into user space and written from there, and once spliced from the socket
+   to the file. Reports the throughput of both. */
+
+constexpr size_t BodySize = 512 * 1024 * 1024;
+constexpr size_t ChunkSize = 64 * 1024;
+
+static int Listen(uint16_t& port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t length = sizeof(address);
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, 1) != 0 ||
+        getsockname(listener, (sockaddr*)&address, &length) != 0)
+    {
+        throw std::runtime_error("Couldn't listen on loopback");
+    }
+
+    port = ntohs(address.sin_port);
+    return listener;
+}
+
+static void Send(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) == 0)
+    {
+        std::vector<char> chunk(ChunkSize, 'x');
+        for (size_t sent = 0; sent < BodySize;)
+        {
+            ssize_t result = send(fd, chunk.data(), std::min(chunk.size(), BodySize - sent), 0);
+            if (result <= 0)
+            {
+                break;
+            }
+
+            sent += (size_t)result;
+        }
+    }
+
+    close(fd);
+}
+
+static void Measure(const std::string& name, int file, bool splice)
+{
+    uint16_t port;
+    int listener = Listen(port);
+    std::unique_ptr<SslContext> noTls;
+
+    size_t received = 0;
+    double seconds = MeasureSeconds([&]()
+        {
+            std::thread client([&]() { Send(port); });
+
+            InetSocketWrapper::InetSocket socket(accept(listener, nullptr, nullptr));
+            Connection connection(std::move(socket), { "127.0.0.1", 0 }, noTls);
+
+            if (splice)
+            {
+                received = connection.SpliceToFile(file, 0, BodySize);
+            }
+            else
+            {
+                while (received < BodySize)
+                {
+                    std::string data = connection.ReceiveString(std::min(ChunkSize, BodySize - received));
+                    if (data.empty() ||
+                        pwrite(file, data.data(), data.size(), (off_t)received) != (ssize_t)data.size())
+                    {
+                        break;
+                    }
+
+                    received += data.size();
+                }
+            }
+
+            client.join();
+        });
+
+    close(listener);
+
+    if (received != BodySize)
+    {
+        Report(name + ": incomplete, received", (double)received / (1024 * 1024), "MB");
+        return;
+    }
+
+    Report(name, BodySize / seconds / (1024 * 1024), "MB/s");
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string path = (std::filesystem::temp_directory_path() / "splice-benchmark-XXXXXX").string();
+    int file = mkstemp(path.data());
+    if (file < 0)
+    {
+        throw std::runtime_error("Couldn't create the file to receive into");
+    }
+
+    unlink(path.c_str());
+
+    Measure("read and write", file, false);
+    Measure("splice", file, true);
+
+    close(file);
+    return 0;
+}
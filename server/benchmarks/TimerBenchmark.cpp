@@ -0,0 +1,124 @@
+#include "Benchmark.hpp"
+
+#include "TimedEvent.hpp"
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Timed::TimedEvent;
+
+/* Keeps a million timers pending, spread like the session, transfer and
+   idle connection timeouts of a busy server, added from several threads.
+   Measures adding and cancelling them, and how late a batch of timers that
+   expire within the same second fires. */
+
+constexpr size_t Timers = 1000000;
+constexpr unsigned Threads = 4;
+constexpr size_t Expiring = 100000;
+
+/* Idle timeouts of seconds, transfers of minutes, sessions of an hour. */
+static TimedEvent::ExpirationDate GetExpiration(std::mt19937& random)
+{
+    auto now = TimedEvent::Clock::now();
+
+    switch (random() % 3)
+    {
+    case 0:
+        return now + std::chrono::seconds(10 + random() % 50);
+    case 1:
+        return now + std::chrono::minutes(5 + random() % 55);
+    default:
+        return now + std::chrono::hours(1) + std::chrono::seconds(random() % 60);
+    }
+}
+
+int main()
+{
+    std::vector<std::unique_ptr<TimedEvent>> events(Timers);
+
+    for (size_t i = 0; i < Timers; i++)
+    {
+        events[i] = std::make_unique<TimedEvent>(TimedEvent::ExpirationDate(), []() {});
+    }
+
+    double seconds = MeasureSeconds([&]()
+        {
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < Threads; t++)
+            {
+                threads.emplace_back([&, t]()
+                    {
+                        std::mt19937 random(t);
+                        for (size_t i = t; i < Timers; i += Threads)
+                        {
+                            events[i]->m_ExpirationDate = GetExpiration(random);
+                            events[i]->AddEvent();
+                        }
+                    });
+            }
+
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        });
+
+    Report("add, " + std::to_string(Threads) + " threads", seconds * 1e9 / Timers, "ns/timer");
+
+    seconds = MeasureSeconds([&]()
+        {
+            for (auto& event : events)
+            {
+                event->Cancel();
+            }
+        });
+
+    Report("cancel", seconds * 1e9 / Timers, "ns/timer");
+
+    /* A batch due within the next second, with the rest still pending. */
+    std::mt19937 random(Threads);
+    for (auto& event : events)
+    {
+        event->m_ExpirationDate = GetExpiration(random);
+        event->AddEvent();
+    }
+
+    std::atomic<size_t> fired = 0;
+    std::atomic<int64_t> maxLateness = 0;
+    std::vector<std::unique_ptr<TimedEvent>> expiring(Expiring);
+
+    auto start = TimedEvent::Clock::now() + std::chrono::milliseconds(100);
+    for (size_t i = 0; i < Expiring; i++)
+    {
+        auto date = start + std::chrono::microseconds(random() % 1000000);
+        expiring[i] = std::make_unique<TimedEvent>(date,
+            [&, date]()
+            {
+                auto lateness = std::chrono::duration_cast<std::chrono::microseconds>(
+                    TimedEvent::Clock::now() - date).count();
+
+                int64_t previous = maxLateness;
+                while (lateness > previous && !maxLateness.compare_exchange_weak(previous, lateness))
+                {
+                }
+
+                fired++;
+            });
+        expiring[i]->AddEvent();
+    }
+
+    auto deadline = start + std::chrono::seconds(5);
+    while (fired < Expiring && TimedEvent::Clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    Report("expired within a second", (double)fired, "timers");
+    Report("expiration, latest callback", maxLateness / 1000.0, "ms late");
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "Benchmark.hpp"
+
+#include "DiskWriter.hpp"
+#include "FileTransfer.hpp"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <filesystem>
+
+#include <unistd.h>
+
+using namespace std::filesystem;
+
+/* Runs 1 to 16 uploads at once, each on its own thread the way connections
+   are served, handing chunks to the DiskWriter like UploadFileApi does.
+   Reports the aggregate throughput until every file is complete. */
+
+constexpr size_t UploadSize = 32 * 1024 * 1024;
+constexpr size_t ChunkSize = 1024 * 1024;
+constexpr size_t MaxUploads = 16;
+
+static void Upload(const path& file, const std::string& chunk)
+{
+    auto id = TransferRegistry::AddTransfer(file, UploadSize);
+
+    for (size_t offset = 0; offset < UploadSize; offset += ChunkSize)
+    {
+        /* Looked up again for every chunk, as every chunk is a request. */
+        auto transfer = TransferRegistry::Find(id);
+        DiskWriter::Get().Enqueue(transfer, offset, chunk);
+    }
+
+    auto transfer = TransferRegistry::Find(id);
+    while (transfer->GetStatus() == TransferStatus::Pending)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    TransferRegistry::Remove(id);
+}
+
+int main()
+{
+    path directory = temp_directory_path() / ("upload-benchmark-" + std::to_string(getpid()));
+    create_directories(directory);
+
+    std::string chunk(ChunkSize, '\0');
+    for (size_t i = 0; i < chunk.size(); i++)
+    {
+        chunk[i] = (char)(i * 31);
+    }
+
+    for (size_t uploads = 1; uploads <= MaxUploads; uploads *= 2)
+    {
+        double seconds = MeasureSeconds([&]()
+            {
+                std::vector<std::thread> threads;
+                for (size_t i = 0; i < uploads; i++)
+                {
+                    threads.emplace_back([&, i]()
+                        {
+                            Upload(directory / ("file" + std::to_string(i)), chunk);
+                        });
+                }
+
+                for (auto& thread : threads)
+                {
+                    thread.join();
+                }
+            });
+
+        Report(std::to_string(uploads) + " concurrent uploads",
+               uploads * UploadSize / seconds / (1024 * 1024), "MB/s");
+
+        for (auto& entry : directory_iterator(directory))
+        {
+            remove(entry.path());
+        }
+    }
+
+    remove_all(directory);
+    return 0;
+}
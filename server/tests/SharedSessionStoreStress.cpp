@@ -0,0 +1,290 @@
+#include "SharedSessionStore.hpp"
+#include "SessionStore.hpp"
+
+#include <map>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* Several processes create, read and update sessions in one segment at
+   once, while other processes writing to it are killed at random points.
+   Fails if a process reads a session with other properties than it last
+   wrote, if a session of one process isn't visible to another one, or if
+   anything hangs on a lock left behind by a killed process. */
+
+constexpr size_t Capacity = 256;
+constexpr size_t HeaderSize = 64;
+constexpr size_t BucketSize = 512;
+
+constexpr int Workers = 6;
+constexpr int SessionsPerWorker = 16;
+constexpr int Victims = 20;
+constexpr auto Duration = std::chrono::seconds(2);
+
+/* Anything that hangs is a failure rather than a stuck test. */
+constexpr unsigned Timeout = 30;
+
+static std::string SegmentName;
+
+/* The PID of a process that surely isn't running anymore. */
+static pid_t GetDeadPid()
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        _exit(0);
+    }
+
+    waitpid(pid, nullptr, 0);
+    return pid;
+}
+
+static uint64_t MakeWord(uint32_t low, pid_t pid)
+{
+    return ((uint64_t)(uint32_t)pid << 32) | low;
+}
+
+/* Maps the segment directly, to leave it as a crashed process would. */
+static char* MapSegment()
+{
+    size_t size = HeaderSize + Capacity * BucketSize;
+
+    int fd = shm_open(SegmentName.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0)
+    {
+        throw std::runtime_error("Unable to create the segment");
+    }
+
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (address == MAP_FAILED)
+    {
+        throw std::runtime_error("Unable to map the segment");
+    }
+
+    return (char*)address;
+}
+
+static bool CheckCrashRecovery()
+{
+    pid_t dead = GetDeadPid();
+    char* segment = MapSegment();
+
+    /* Died right after claiming the initialization. */
+    uint64_t initializing = MakeWord(1, dead);
+    std::memcpy(segment, &initializing, sizeof(initializing));
+
+    SharedSessionStore store(SegmentName, Capacity);
+
+    /* Died holding the lock of every bucket. */
+    uint64_t locked = MakeWord(1, dead);
+    for (size_t i = 0; i < Capacity; i++)
+    {
+        std::memcpy(segment + HeaderSize + i * BucketSize, &locked, sizeof(locked));
+    }
+
+    std::string sessionId = store.CreateSession({ { "username", "recovered" } });
+    auto session = store.OpenSession(sessionId);
+
+    munmap(segment, HeaderSize + Capacity * BucketSize);
+
+    if (session == nullptr || session->ReadProperty("username") != "recovered")
+    {
+        std::cerr << "Session not usable after recovering from a dead process\n";
+        return false;
+    }
+
+    return true;
+}
+
+/* Keeps writing to its sessions until it is killed. */
+static void RunVictim()
+{
+    SharedSessionStore store(SegmentName, Capacity);
+    std::string sessionId = store.CreateSession({ { "username", "victim" } });
+
+    for (uint64_t i = 0;; i++)
+    {
+        if (auto session = store.OpenSession(sessionId))
+        {
+            session->WriteProperty("counter", std::to_string(i));
+        }
+    }
+}
+
+/* Reports its sessions and their counters through the pipe once done. */
+static int RunWorker(int worker, int output)
+{
+    SharedSessionStore store(SegmentName, Capacity);
+    std::mt19937 random(worker);
+
+    struct Owned
+    {
+        std::string m_Id;
+        std::string m_Username;
+        uint64_t m_Counter;
+    };
+
+    std::vector<Owned> sessions;
+    int created = 0;
+
+    auto create = [&]()
+    {
+        std::string username = "worker" + std::to_string(worker) + "-" + std::to_string(created++);
+        std::string sessionId = store.CreateSession({ { "username", username }, { "counter", "0" } });
+        return Owned{ sessionId, username, 0 };
+    };
+
+    for (int i = 0; i < SessionsPerWorker; i++)
+    {
+        sessions.push_back(create());
+    }
+
+    size_t lost = 0;
+    auto end = std::chrono::steady_clock::now() + Duration;
+
+    while (std::chrono::steady_clock::now() < end)
+    {
+        Owned& owned = sessions[random() % sessions.size()];
+
+        auto session = store.OpenSession(owned.m_Id);
+        if (session == nullptr)
+        {
+            /* Discarded while a killed process held its bucket. */
+            lost++;
+            owned = create();
+            continue;
+        }
+
+        if (session->ReadProperty("username") != owned.m_Username ||
+            session->ReadProperty("counter") != std::to_string(owned.m_Counter))
+        {
+            std::cerr << "Worker " << worker << " read " << session->ReadProperty("username") << " "
+                      << session->ReadProperty("counter") << ", expected " << owned.m_Username << " "
+                      << owned.m_Counter << "\n";
+            return 1;
+        }
+
+        session->WriteProperty("counter", std::to_string(++owned.m_Counter));
+    }
+
+    std::string report;
+    for (auto& owned : sessions)
+    {
+        report += owned.m_Id + " " + owned.m_Username + " " + std::to_string(owned.m_Counter) + "\n";
+    }
+
+    if (write(output, report.data(), report.size()) != (ssize_t)report.size())
+    {
+        return 1;
+    }
+
+    std::cout << "Worker " << worker << " lost " << lost << " sessions to killed processes" << std::endl;
+    return 0;
+}
+
+int main()
+{
+    alarm(Timeout);
+
+    SegmentName = "/server-sessions-stress-" + std::to_string(getpid());
+    SharedSessionStore::Unlink(SegmentName);
+
+    bool passed = CheckCrashRecovery();
+    SharedSessionStore::Unlink(SegmentName);
+
+    /* Workers report through pipes, read once they exited. */
+    std::vector<std::pair<pid_t, int>> workers;
+    for (int i = 0; i < Workers; i++)
+    {
+        int pipeEnds[2];
+        if (pipe(pipeEnds) != 0)
+        {
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(pipeEnds[0]);
+            _exit(RunWorker(i, pipeEnds[1]));
+        }
+
+        close(pipeEnds[1]);
+        workers.emplace_back(pid, pipeEnds[0]);
+    }
+
+    std::mt19937 random(getpid());
+    for (int i = 0; i < Victims; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            RunVictim();
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(random() % 50000));
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+
+    std::string reports;
+    for (auto [pid, input] : workers)
+    {
+        char buffer[4096];
+        ssize_t got;
+        while ((got = read(input, buffer, sizeof(buffer))) > 0)
+        {
+            reports.append(buffer, (size_t)got);
+        }
+
+        close(input);
+
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::cerr << "Worker " << pid << " failed\n";
+            passed = false;
+        }
+    }
+
+    /* What the workers wrote last is visible to another process. */
+    SharedSessionStore store(SegmentName, Capacity);
+    std::istringstream lines(reports);
+    std::string sessionId, username, counter;
+    size_t checked = 0;
+
+    while (lines >> sessionId >> username >> counter)
+    {
+        auto session = store.OpenSession(sessionId);
+        if (session == nullptr ||
+            session->ReadProperty("username") != username ||
+            session->ReadProperty("counter") != counter)
+        {
+            std::cerr << "Session of " << username << " isn't visible from another process\n";
+            passed = false;
+        }
+
+        checked++;
+    }
+
+    SharedSessionStore::Unlink(SegmentName);
+
+    std::cout << "Checked " << checked << " sessions across processes\n";
+    std::cout << (passed ? "Passed\n" : "Failed\n");
+    return passed ? 0 : 1;
+}